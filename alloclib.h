@@ -0,0 +1,473 @@
+// ============================================================================
+// Bump Arena Backend
+// ============================================================================
+//
+// An experiment backend: every allocation bumps a pointer through one large
+// reservation that is only committed as it is touched, and the caller resets
+// the whole arena between calls. free() only gives back the newest block, and
+// realloc() of the newest block grows in place. Blocks keep malloc()'s
+// 16-byte alignment. Lock-free (compare-and-swap on the offset), so compiled
+// code may allocate from several threads.
+
+#include <malloc.h>
+#include <sys/mman.h>
+
+#define BUMP_ARENA_RESERVE  (1ULL << 32)   // Address space only, 4 GiB
+#define BUMP_ALIGN          16
+#define BUMP_HEADER         BUMP_ALIGN     // Block size, kept in front of the block
+
+typedef struct {
+    unsigned char *base;
+    size_t reserved;
+    size_t used;                        // Offset of the next block (atomic)
+    size_t peak;                        // Most bytes in use since the last report
+    size_t high_water;                  // Most bytes in use ever
+    uint64_t failures;                  // Requests that didn't fit (atomic)
+} Bump_Arena;
+
+static Bump_Arena bump_arena = {0};
+
+// Reserve the address space (main thread, before the arena is used)
+bool bump_arena_init(void) {
+    if (bump_arena.base) return true;
+    void *base = mmap(NULL, BUMP_ARENA_RESERVE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) return false;
+    bump_arena.base = base;
+    bump_arena.reserved = BUMP_ARENA_RESERVE;
+    return true;
+}
+
+static bool bump_owns(const void *ptr) {
+    const unsigned char *p = ptr;
+    return bump_arena.base && p >= bump_arena.base && p < bump_arena.base + bump_arena.reserved;
+}
+
+static size_t bump_block_size(const void *ptr) {
+    return *(const size_t *)((const unsigned char *)ptr - BUMP_HEADER);
+}
+
+static void *bump_malloc(size_t size) {
+    if (size > bump_arena.reserved) goto full;
+    size_t need = BUMP_HEADER + ((size + BUMP_ALIGN - 1) & ~(size_t)(BUMP_ALIGN - 1));
+    size_t used = __atomic_load_n(&bump_arena.used, __ATOMIC_RELAXED);
+    do {
+        if (need > bump_arena.reserved - used) goto full;
+    } while (!__atomic_compare_exchange_n(&bump_arena.used, &used, used + need, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    *(size_t *)(bump_arena.base + used) = size;
+    return bump_arena.base + used + BUMP_HEADER;
+
+full:
+    __atomic_add_fetch(&bump_arena.failures, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// Offset just past ptr's block
+static size_t bump_block_end(const void *ptr) {
+    size_t size = bump_block_size(ptr);
+    size_t offset = (size_t)((const unsigned char *)ptr - bump_arena.base);
+    return offset + ((size + BUMP_ALIGN - 1) & ~(size_t)(BUMP_ALIGN - 1));
+}
+
+static void bump_free(void *ptr) {
+    // Give the space back only if ptr is still the newest block
+    size_t end = bump_block_end(ptr);
+    size_t start = (size_t)((unsigned char *)ptr - bump_arena.base) - BUMP_HEADER;
+    __atomic_compare_exchange_n(&bump_arena.used, &end, start, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static void *bump_realloc(void *ptr, size_t size) {
+    size_t old_size = bump_block_size(ptr);
+    size_t end = bump_block_end(ptr);
+    size_t start = (size_t)((unsigned char *)ptr - bump_arena.base);
+    size_t new_end = start + ((size + BUMP_ALIGN - 1) & ~(size_t)(BUMP_ALIGN - 1));
+    if (size <= bump_arena.reserved && new_end <= bump_arena.reserved &&
+        __atomic_compare_exchange_n(&bump_arena.used, &end, new_end, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *(size_t *)((unsigned char *)ptr - BUMP_HEADER) = size;
+        return ptr;
+    }
+    if (size <= old_size) return ptr;  // Not the newest: shrink by keeping it
+
+    void *moved = bump_malloc(size);
+    if (moved) memcpy(moved, ptr, old_size < size ? old_size : size);
+    return moved;
+}
+
+// Drop every block. Pages stay committed, so the next call doesn't fault.
+void bump_arena_reset(void) {
+    size_t used = __atomic_exchange_n(&bump_arena.used, 0, __ATOMIC_RELAXED);
+    if (used > bump_arena.peak) bump_arena.peak = used;
+    if (used > bump_arena.high_water) bump_arena.high_water = used;
+}
+
+void bump_arena_free(void) {
+    if (bump_arena.base) munmap(bump_arena.base, bump_arena.reserved);
+    memset(&bump_arena, 0, sizeof(bump_arena));
+}
+
+// ============================================================================
+// Allocation Tracking
+// ============================================================================
+//
+// Counting versions of malloc, calloc, realloc and free, used by the hooks
+// below when counting is on. They forward to the C library and remember
+// every live block in an open-addressing table, so a pointer they didn't
+// hand out (from strdup(), a library, or an image built before tracking was
+// on) is passed through to free() untouched.
+//
+// Counts are collected between alloc_window_begin() and alloc_window_end():
+// blocks, bytes, the peak of live bytes above the level at the start, and
+// the blocks allocated in the window that are still live at its end.
+
+#include <pthread.h>
+
+typedef enum {
+    ALLOC_BACKEND_LIBC,
+    ALLOC_BACKEND_BUMP,
+} Alloc_Backend;
+
+// Selected by the REPL between calls (see Allocator Hooks)
+static Alloc_Backend alloc_backend = ALLOC_BACKEND_LIBC;
+static bool alloc_counting = false;     // Route the C library through the tracker
+
+typedef struct {
+    uint64_t allocs;                    // malloc and calloc
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes;                     // Requested by every malloc/calloc/realloc
+    uint64_t untracked_frees;           // Pointers the tracker didn't hand out
+    size_t peak_live;                   // Above the live bytes at the start
+    uint64_t leaked_blocks;             // Allocated in the window, still live
+    size_t leaked_bytes;
+} Alloc_Stats;
+
+typedef struct {
+    void *ptr;                          // NULL marks an empty slot
+    size_t size;
+    uint64_t window;                    // Window it was allocated in (0: none)
+} Alloc_Block;
+
+typedef struct {
+    pthread_mutex_t lock;               // Compiled code may allocate from threads
+    Alloc_Block *slots;
+    size_t capacity;                    // Power of two
+    size_t count;
+    size_t live_bytes;
+    size_t window_base;                 // live_bytes when the window opened
+    size_t window_peak;
+    uint64_t window;                    // Current window, 0 when none is open
+    uint64_t windows;                   // Opened so far, numbers the next one
+    Alloc_Stats stats;
+} Alloc_Tracker;
+
+static Alloc_Tracker alloc_tracker = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static size_t alloc_slot_of(const void *ptr, size_t capacity) {
+    uint64_t h = (uint64_t)(uintptr_t)ptr >> 4;  // malloc aligns to 16
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h >> 32) & (capacity - 1);
+}
+
+// Slot holding ptr, or capacity when it isn't tracked
+static size_t alloc_find(const void *ptr) {
+    if (alloc_tracker.capacity == 0) return 0;
+    size_t mask = alloc_tracker.capacity - 1;
+    for (size_t i = alloc_slot_of(ptr, alloc_tracker.capacity);; i = (i + 1) & mask) {
+        if (alloc_tracker.slots[i].ptr == ptr) return i;
+        if (alloc_tracker.slots[i].ptr == NULL) return alloc_tracker.capacity;
+    }
+}
+
+static bool alloc_grow(void) {
+    size_t capacity = alloc_tracker.capacity ? alloc_tracker.capacity * 2 : 1024;
+    Alloc_Block *slots = calloc(capacity, sizeof(Alloc_Block));
+    if (!slots) return false;
+    for (size_t i = 0; i < alloc_tracker.capacity; i++) {
+        Alloc_Block *block = &alloc_tracker.slots[i];
+        if (!block->ptr) continue;
+        size_t j = alloc_slot_of(block->ptr, capacity);
+        while (slots[j].ptr) j = (j + 1) & (capacity - 1);
+        slots[j] = *block;
+    }
+    free(alloc_tracker.slots);
+    alloc_tracker.slots = slots;
+    alloc_tracker.capacity = capacity;
+    return true;
+}
+
+static void alloc_remove(size_t i);
+
+// Record block as live. Called with the lock held.
+static void alloc_place(Alloc_Block block) {
+    Alloc_Tracker *t = &alloc_tracker;
+    // Still recorded: the block was freed by code that bypasses the tracker
+    size_t stale = alloc_find(block.ptr);
+    if (stale < t->capacity) alloc_remove(stale);
+    if ((t->count + 1) * 2 > t->capacity && !alloc_grow()) return;  // Left untracked
+
+    size_t i = alloc_slot_of(block.ptr, t->capacity);
+    while (t->slots[i].ptr) i = (i + 1) & (t->capacity - 1);
+    t->slots[i] = block;
+    t->count++;
+    t->live_bytes += block.size;
+
+    if (t->window && block.window == t->window) {
+        t->stats.leaked_blocks++;
+        t->stats.leaked_bytes += block.size;
+    }
+    if (t->window && t->live_bytes > t->window_peak) t->window_peak = t->live_bytes;
+}
+
+// Record a new allocation. Called with the lock held.
+static void alloc_insert(void *ptr, size_t size) {
+    if (alloc_tracker.window) alloc_tracker.stats.bytes += size;
+    alloc_place((Alloc_Block){ ptr, size, alloc_tracker.window });
+}
+
+// Forget the block in slot i, shifting its probe chain back (no tombstones).
+// Called with the lock held.
+static void alloc_remove(size_t i) {
+    Alloc_Tracker *t = &alloc_tracker;
+    Alloc_Block *block = &t->slots[i];
+    t->live_bytes -= block->size;
+    if (t->window && block->window == t->window) {
+        t->stats.leaked_blocks--;
+        t->stats.leaked_bytes -= block->size;
+    }
+    t->count--;
+
+    size_t mask = t->capacity - 1;
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; t->slots[j].ptr; j = (j + 1) & mask) {
+        size_t home = alloc_slot_of(t->slots[j].ptr, t->capacity);
+        // Move j into the hole unless its home lies cyclically in (hole, j]
+        bool stays = hole <= j ? (hole < home && home <= j) : (hole < home || home <= j);
+        if (!stays) {
+            t->slots[hole] = t->slots[j];
+            hole = j;
+        }
+    }
+    t->slots[hole].ptr = NULL;
+}
+
+void *alloc_track_malloc(size_t size) {
+    void *ptr = malloc(size);
+    if (!ptr) return NULL;
+    pthread_mutex_lock(&alloc_tracker.lock);
+    if (alloc_tracker.window) alloc_tracker.stats.allocs++;
+    alloc_insert(ptr, size);
+    pthread_mutex_unlock(&alloc_tracker.lock);
+    return ptr;
+}
+
+void *alloc_track_calloc(size_t count, size_t size) {
+    void *ptr = calloc(count, size);
+    if (!ptr) return NULL;
+    pthread_mutex_lock(&alloc_tracker.lock);
+    if (alloc_tracker.window) alloc_tracker.stats.allocs++;
+    alloc_insert(ptr, count * size);  // calloc() already rejected an overflow
+    pthread_mutex_unlock(&alloc_tracker.lock);
+    return ptr;
+}
+
+void alloc_track_free(void *ptr) {
+    if (!ptr) return;
+    pthread_mutex_lock(&alloc_tracker.lock);
+    size_t i = alloc_find(ptr);
+    if (alloc_tracker.window) {
+        if (i < alloc_tracker.capacity) alloc_tracker.stats.frees++;
+        else alloc_tracker.stats.untracked_frees++;
+    }
+    if (i < alloc_tracker.capacity) alloc_remove(i);
+    pthread_mutex_unlock(&alloc_tracker.lock);
+    free(ptr);
+}
+
+void *alloc_track_realloc(void *ptr, size_t size) {
+    if (!ptr) return alloc_track_malloc(size);
+    if (size == 0) {
+        alloc_track_free(ptr);
+        return NULL;
+    }
+
+    // Forget the old block before realloc() frees it: from then on another
+    // thread may get the same address. Put back if realloc() fails.
+    pthread_mutex_lock(&alloc_tracker.lock);
+    size_t i = alloc_find(ptr);
+    bool tracked = i < alloc_tracker.capacity;
+    Alloc_Block old = tracked ? alloc_tracker.slots[i] : (Alloc_Block){0};
+    if (tracked) alloc_remove(i);
+    pthread_mutex_unlock(&alloc_tracker.lock);
+
+    void *moved = realloc(ptr, size);
+
+    pthread_mutex_lock(&alloc_tracker.lock);
+    if (moved) {
+        if (alloc_tracker.window) alloc_tracker.stats.reallocs++;
+        alloc_insert(moved, size);
+    } else if (tracked) {
+        alloc_place(old);
+    }
+    pthread_mutex_unlock(&alloc_tracker.lock);
+    return moved;
+}
+
+void alloc_window_begin(void) {
+    pthread_mutex_lock(&alloc_tracker.lock);
+    alloc_tracker.window = ++alloc_tracker.windows;
+    memset(&alloc_tracker.stats, 0, sizeof(alloc_tracker.stats));
+    alloc_tracker.window_base = alloc_tracker.live_bytes;
+    alloc_tracker.window_peak = alloc_tracker.live_bytes;
+    pthread_mutex_unlock(&alloc_tracker.lock);
+}
+
+void alloc_window_end(Alloc_Stats *stats) {
+    pthread_mutex_lock(&alloc_tracker.lock);
+    *stats = alloc_tracker.stats;
+    stats->peak_live = alloc_tracker.window_peak - alloc_tracker.window_base;
+    if (alloc_backend == ALLOC_BACKEND_BUMP) {
+        // Nothing outlives the reset that follows, and blocks are never reused
+        size_t used = __atomic_load_n(&bump_arena.used, __ATOMIC_RELAXED);
+        stats->peak_live = used > bump_arena.peak ? used : bump_arena.peak;
+        stats->leaked_blocks = 0;
+        stats->leaked_bytes = 0;
+    }
+    alloc_tracker.window = 0;  // Blocks of this window no longer count as leaks
+    pthread_mutex_unlock(&alloc_tracker.lock);
+}
+
+// Blocks still live (allocated while tracking was on and never freed)
+size_t alloc_live_blocks(size_t *bytes) {
+    pthread_mutex_lock(&alloc_tracker.lock);
+    size_t count = alloc_tracker.count;
+    if (bytes) *bytes = alloc_tracker.live_bytes;
+    pthread_mutex_unlock(&alloc_tracker.lock);
+    return count;
+}
+
+// The blocks themselves are left alone: compiled code may still use them
+void alloc_tracker_free(void) {
+    pthread_mutex_lock(&alloc_tracker.lock);
+    free(alloc_tracker.slots);
+    alloc_tracker.slots = NULL;
+    alloc_tracker.capacity = 0;
+    alloc_tracker.count = 0;
+    alloc_tracker.live_bytes = 0;
+    pthread_mutex_unlock(&alloc_tracker.lock);
+}
+
+static void alloc_format_bytes(double bytes, char *out, size_t size) {
+    if (bytes >= 1024.0 * 1024.0) snprintf(out, size, "%.2f MiB", bytes / (1024.0 * 1024.0));
+    else if (bytes >= 1024.0) snprintf(out, size, "%.2f KiB", bytes / 1024.0);
+    else snprintf(out, size, "%.0f B", bytes);
+}
+
+// "allocs 3 (1.50 KiB)  reallocs 0  frees 2  peak live +1.00 KiB  leaked 1 (512 B)",
+// counts and bytes divided by calls (the leak is the total of the window)
+void alloc_stats_print(const Alloc_Stats *stats, double calls) {
+    char bytes[32], peak[32], leaked[32];
+    alloc_format_bytes(stats->bytes / calls, bytes, sizeof(bytes));
+    alloc_format_bytes((double)stats->peak_live, peak, sizeof(peak));
+    alloc_format_bytes((double)stats->leaked_bytes, leaked, sizeof(leaked));
+    int digits = calls > 1 ? 2 : 0;
+
+    printf("  allocs %.*f (%s)  reallocs %.*f  frees %.*f  peak live +%s  leaked %llu (%s)",
+           digits, stats->allocs / calls, bytes, digits, stats->reallocs / calls,
+           digits, stats->frees / calls, peak, (unsigned long long)stats->leaked_blocks, leaked);
+    if (stats->untracked_frees) {
+        printf("  untracked frees %llu", (unsigned long long)stats->untracked_frees);
+    }
+    printf("%s\n", calls > 1 ? "  per call" : "");
+}
+
+// ============================================================================
+// Allocator Hooks
+// ============================================================================
+//
+// What in-memory images are linked against with tcc_add_symbol() in place of
+// malloc, calloc, realloc and free. Each call goes to the bump arena or to the C library,
+// counted or not, as selected at the time, so the backend can be switched
+// per call without relinking. Blocks are freed by whichever backend owns
+// them, whatever is selected now.
+
+// Count an arena request in the open window (the arena has no live table)
+static void alloc_count_bump(uint64_t *counter, size_t size) {
+    if (!alloc_counting) return;
+    pthread_mutex_lock(&alloc_tracker.lock);
+    if (alloc_tracker.window) {
+        (*counter)++;
+        alloc_tracker.stats.bytes += size;
+    }
+    pthread_mutex_unlock(&alloc_tracker.lock);
+}
+
+void *alloc_hook_malloc(size_t size) {
+    if (alloc_backend == ALLOC_BACKEND_BUMP) {
+        alloc_count_bump(&alloc_tracker.stats.allocs, size);
+        return bump_malloc(size);
+    }
+    return alloc_counting ? alloc_track_malloc(size) : malloc(size);
+}
+
+void *alloc_hook_calloc(size_t count, size_t size) {
+    if (alloc_backend == ALLOC_BACKEND_BUMP) {
+        if (size && count > SIZE_MAX / size) return NULL;
+        alloc_count_bump(&alloc_tracker.stats.allocs, count * size);
+        void *ptr = bump_malloc(count * size);
+        if (ptr) memset(ptr, 0, count * size);  // Reused after a reset
+        return ptr;
+    }
+    return alloc_counting ? alloc_track_calloc(count, size) : calloc(count, size);
+}
+
+void alloc_hook_free(void *ptr) {
+    if (bump_owns(ptr)) {
+        alloc_count_bump(&alloc_tracker.stats.frees, 0);
+        bump_free(ptr);
+    } else if (alloc_counting) {
+        alloc_track_free(ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+void *alloc_hook_realloc(void *ptr, size_t size) {
+    bool in_arena = bump_owns(ptr);
+    bool to_arena = alloc_backend == ALLOC_BACKEND_BUMP;
+    if (!ptr) return alloc_hook_malloc(size);
+    if (in_arena && to_arena) {
+        alloc_count_bump(&alloc_tracker.stats.reallocs, size);
+        return bump_realloc(ptr, size);
+    }
+    if (!in_arena && !to_arena) {
+        return alloc_counting ? alloc_track_realloc(ptr, size) : realloc(ptr, size);
+    }
+
+    // Moving between backends (it was switched since ptr was allocated)
+    size_t old_size = in_arena ? bump_block_size(ptr) : malloc_usable_size(ptr);
+    void *moved = alloc_hook_malloc(size ? size : 1);
+    if (!moved) return NULL;
+    memcpy(moved, ptr, old_size < size ? old_size : size);
+    alloc_hook_free(ptr);
+    return moved;
+}
+
+// "  arena peak 1.50 KiB  high water 4.00 KiB": the peak since the last report,
+// which restarts it (call after the reset that ends a call)
+void bump_arena_print(void) {
+    size_t used = __atomic_load_n(&bump_arena.used, __ATOMIC_RELAXED);
+    if (used > bump_arena.peak) bump_arena.peak = used;
+    if (used > bump_arena.high_water) bump_arena.high_water = used;
+
+    char peak[32], high[32];
+    alloc_format_bytes((double)bump_arena.peak, peak, sizeof(peak));
+    alloc_format_bytes((double)bump_arena.high_water, high, sizeof(high));
+    printf("  arena peak %s  high water %s", peak, high);
+    uint64_t failures = __atomic_load_n(&bump_arena.failures, __ATOMIC_RELAXED);
+    if (failures) printf("  %llu request(s) didn't fit so far", (unsigned long long)failures);
+    printf("\n");
+    bump_arena.peak = 0;
+}
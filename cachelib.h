@@ -0,0 +1,343 @@
+// ============================================================================
+// Compiled Image Cache
+// ============================================================================
+//
+// Compiled sources are stored as shared objects under the cache directory,
+// named after a 64-bit FNV-1a key over everything that affects the output
+// (source text, local headers, include paths, TCC version, libraries).
+// A sidecar .meta file records how long the original compile took so that
+// cache hits can report the time they saved. The directory is trimmed to
+// a size bound, least recently used entries first.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#define FNV1A64_INIT 0xcbf29ce484222325ULL
+
+static uint64_t fnv1a64(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t fnv1a64_str(uint64_t hash, const char *str) {
+    // Include the terminator so ("ab","c") and ("a","bc") hash differently
+    return str ? fnv1a64(hash, str, strlen(str) + 1) : fnv1a64(hash, "", 1);
+}
+
+// mkdir -p
+static bool make_directories(const char *path) {
+    char tmp[4096];
+    size_t len = strlen(path);
+    if (len == 0 || len >= sizeof(tmp)) return false;
+    memcpy(tmp, path, len + 1);
+
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(tmp, 0700) != 0 && errno != EEXIST) return false;
+            *p = '/';
+        }
+    }
+    if (mkdir(tmp, 0700) != 0 && errno != EEXIST) return false;
+    return true;
+}
+
+// Resolve the cache directory (cached result). Returns NULL when caching is
+// disabled via MALCREPL_NO_CACHE or no usable directory exists.
+const char *cache_dir(void) {
+    static char path[4096];
+    static bool resolved = false;
+    static bool available = false;
+
+    if (resolved) return available ? path : NULL;
+    resolved = true;
+
+    if (getenv("MALCREPL_NO_CACHE")) return NULL;
+
+    const char *dir = getenv("MALCREPL_CACHE_DIR");
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (dir && dir[0]) {
+        snprintf(path, sizeof(path), "%s", dir);
+    } else if (xdg && xdg[0]) {
+        snprintf(path, sizeof(path), "%s/malcrepl", xdg);
+    } else if (home && home[0]) {
+        snprintf(path, sizeof(path), "%s/.cache/malcrepl", home);
+    } else {
+        return NULL;
+    }
+
+    if (!make_directories(path)) {
+        fprintf(stderr, "WARNING: Could not create cache directory '%s'\n", path);
+        return NULL;
+    }
+
+    available = true;
+    return path;
+}
+
+// Build "<cache_dir>/<key><suffix>"
+bool cache_entry_path(uint64_t key, const char *suffix, char *out, size_t size) {
+    const char *dir = cache_dir();
+    if (!dir) return false;
+    int n = snprintf(out, size, "%s/%016llx%s", dir, (unsigned long long)key, suffix);
+    return n > 0 && (size_t)n < size;
+}
+
+// Compile time recorded when the entry was created, or a negative value
+double cache_read_compile_ms(uint64_t key) {
+    char path[4096];
+    if (!cache_entry_path(key, ".meta", path, sizeof(path))) return -1.0;
+
+    FILE *f = fopen(path, "r");
+    if (!f) return -1.0;
+
+    double ms = -1.0;
+    if (fscanf(f, "compile_ms=%lf", &ms) != 1) ms = -1.0;
+    fclose(f);
+    return ms;
+}
+
+// Written to a temporary file and renamed, like the image, so a concurrent
+// reader never sees a partial record
+void cache_write_compile_ms(uint64_t key, double ms) {
+    char path[4096];
+    if (!cache_entry_path(key, ".meta", path, sizeof(path))) return;
+    char tmp_path[4096 + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) return;
+    bool ok = fprintf(f, "compile_ms=%.3f\n", ms) > 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp_path, path) != 0) unlink(tmp_path);
+}
+
+// Copy image_path to a new file next to it and return the copy's path in
+// out. The dynamic linker hands back the already loaded object for a path
+// or inode it has seen (a hard link shares the inode), so loading a second,
+// independent instance of a cached image needs a real copy.
+bool cache_private_copy(const char *image_path, char *out, size_t size) {
+    int n = snprintf(out, size, "%s.XXXXXX", image_path);
+    if (n <= 0 || (size_t)n >= size) return false;
+
+    int in = open(image_path, O_RDONLY);
+    if (in < 0) return false;
+    int copy = mkstemp(out);
+    if (copy < 0) {
+        close(in);
+        return false;
+    }
+
+    char buffer[65536];
+    bool ok = true;
+    ssize_t got;
+    while (ok && (got = read(in, buffer, sizeof(buffer))) != 0) {
+        if (got < 0) {
+            ok = errno == EINTR;
+            continue;
+        }
+        for (ssize_t done = 0; ok && done < got; ) {
+            ssize_t put = write(copy, buffer + done, got - done);
+            if (put > 0) done += put;
+            else ok = put < 0 && errno == EINTR;
+        }
+    }
+    close(in);
+    ok = close(copy) == 0 && ok;
+    if (!ok) unlink(out);
+    return ok;
+}
+
+// Mark an entry as used so trimming evicts it last
+void cache_touch(uint64_t key) {
+    char path[4096];
+    if (cache_entry_path(key, ".so", path, sizeof(path))) utimensat(AT_FDCWD, path, NULL, 0);
+}
+
+#define CACHE_DEFAULT_MAX_MB 256
+#define CACHE_STALE_TEMP_SECONDS (60 * 60)
+
+typedef struct {
+    uint64_t key;
+    off_t bytes;            // Image plus .meta
+    time_t used;            // Image mtime, refreshed on every hit
+} Cache_Entry;
+
+static int compare_cache_entry_used(const void *a, const void *b) {
+    time_t x = ((const Cache_Entry *)a)->used;
+    time_t y = ((const Cache_Entry *)b)->used;
+    return (x > y) - (x < y);
+}
+
+// Image entries are "<16 hex digits>.so"; temporaries add a suffix to an
+// entry name ("<key>.so.<pid>.tmp", "<key>.so.XXXXXX", "<key>.meta.<pid>.tmp")
+static bool cache_parse_name(const char *name, uint64_t *key, const char **suffix) {
+    char digits[17];
+    for (int i = 0; i < 16; i++) {
+        if (!isxdigit((unsigned char)name[i])) return false;
+        digits[i] = name[i];
+    }
+    digits[16] = '\0';
+    *key = strtoull(digits, NULL, 16);
+    *suffix = name + 16;
+    return true;
+}
+
+// Keep the image cache under MALCREPL_CACHE_MAX_MB (default 256 MiB) by
+// deleting the least recently used entries. keep is never evicted (the
+// entry just stored). Temporaries left behind by a crash are removed once
+// they are an hour old. Loaded images stay mapped after their file is gone.
+void cache_trim(uint64_t keep) {
+    const char *dir = cache_dir();
+    if (!dir) return;
+    const char *limit_env = getenv("MALCREPL_CACHE_MAX_MB");
+    long long max_mb = limit_env && limit_env[0] ? atoll(limit_env) : CACHE_DEFAULT_MAX_MB;
+    if (max_mb <= 0) return;  // 0 disables the bound
+
+    DIR *d = opendir(dir);
+    if (!d) return;
+
+    Cache_Entry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    off_t total = 0;
+    time_t now = time(NULL);
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        uint64_t key;
+        const char *suffix;
+        if (!cache_parse_name(ent->d_name, &key, &suffix)) continue;
+
+        char path[4096 + 256];
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+        if (strcmp(suffix, ".so") == 0) {
+            char meta[4096];
+            struct stat meta_st;
+            off_t meta_bytes = cache_entry_path(key, ".meta", meta, sizeof(meta)) &&
+                               stat(meta, &meta_st) == 0 ? meta_st.st_size : 0;
+            Cache_Entry entry = { .key = key, .bytes = st.st_size + meta_bytes,
+                                  .used = st.st_mtime };
+            total += entry.bytes;
+            if (key == keep) continue;
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                Cache_Entry *grown = realloc(entries, capacity * sizeof(Cache_Entry));
+                if (!grown) break;
+                entries = grown;
+            }
+            entries[count++] = entry;
+        } else if (strcmp(suffix, ".meta") != 0 &&
+                   now - st.st_mtime > CACHE_STALE_TEMP_SECONDS) {
+            unlink(path);
+        }
+    }
+    closedir(d);
+
+    off_t max_bytes = (off_t)max_mb * 1024 * 1024;
+    if (total > max_bytes && count > 0) {
+        qsort(entries, count, sizeof(Cache_Entry), compare_cache_entry_used);
+        for (size_t i = 0; i < count && total > max_bytes; i++) {
+            char path[4096];
+            if (cache_entry_path(entries[i].key, ".so", path, sizeof(path))) unlink(path);
+            if (cache_entry_path(entries[i].key, ".meta", path, sizeof(path))) unlink(path);
+            total -= entries[i].bytes;
+        }
+    }
+    free(entries);
+}
+
+// ============================================================================
+// Local Include Discovery
+// ============================================================================
+
+// Call fn(path, contents, ctx) for every `#include "file"` reachable from source_code,
+// resolved relative to base_dir. Each file is reported once; nesting is
+// followed up to a fixed depth so include cycles terminate.
+typedef void (*Include_Visitor)(const char *path, const char *contents, void *ctx);
+
+#define LOCAL_INCLUDE_MAX_DEPTH 8
+#define LOCAL_INCLUDE_MAX_FILES 256
+
+typedef struct {
+    char *paths[LOCAL_INCLUDE_MAX_FILES];
+    size_t count;
+} Include_Seen;
+
+static void visit_local_includes_rec(const char *source_code, const char *base_dir,
+                                     Include_Visitor fn, void *ctx,
+                                     Include_Seen *seen, int depth) {
+    if (!source_code || depth > LOCAL_INCLUDE_MAX_DEPTH) return;
+
+    const char *p = source_code;
+    while ((p = strstr(p, "#include")) != NULL) {
+        p += 8;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != '"') continue;
+
+        const char *name = ++p;
+        while (*p && *p != '"' && *p != '\n') p++;
+        if (*p != '"') continue;
+
+        char path[4096];
+        int n;
+        if (name[0] == '/') {
+            n = snprintf(path, sizeof(path), "%.*s", (int)(p - name), name);
+        } else {
+            n = snprintf(path, sizeof(path), "%s/%.*s",
+                         base_dir && base_dir[0] ? base_dir : ".", (int)(p - name), name);
+        }
+        if (n <= 0 || (size_t)n >= sizeof(path)) continue;
+
+        bool already = false;
+        for (size_t i = 0; i < seen->count; i++) {
+            if (strcmp(seen->paths[i], path) == 0) {
+                already = true;
+                break;
+            }
+        }
+        if (already || seen->count >= LOCAL_INCLUDE_MAX_FILES) continue;
+
+        FILE *f = fopen(path, "rb");
+        if (!f) continue;  // May live on a system include path instead
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        rewind(f);
+        char *contents = size >= 0 ? malloc(size + 1) : NULL;
+        if (!contents) {
+            fclose(f);
+            continue;
+        }
+        size_t read_bytes = fread(contents, 1, size, f);
+        contents[read_bytes] = '\0';
+        fclose(f);
+
+        seen->paths[seen->count++] = strdup(path);
+        fn(path, contents, ctx);
+
+        // Nested includes resolve relative to the including header
+        char nested_dir[4096];
+        snprintf(nested_dir, sizeof(nested_dir), "%s", path);
+        char *slash = strrchr(nested_dir, '/');
+        if (slash) *slash = '\0';
+        visit_local_includes_rec(contents, nested_dir, fn, ctx, seen, depth + 1);
+        free(contents);
+    }
+}
+
+void visit_local_includes(const char *source_code, const char *base_dir,
+                          Include_Visitor fn, void *ctx) {
+    Include_Seen seen = {0};
+    visit_local_includes_rec(source_code, base_dir, fn, ctx, &seen, 0);
+    for (size_t i = 0; i < seen.count; i++) {
+        free(seen.paths[i]);
+    }
+}
@@ -1,6 +1,23 @@
 // URL handling library
 #include "netlib.h"
 
+#include <time.h>
+
+// Time spent in each stage of the last get_source_code()/reload_source() call
+// on this thread (per thread, so background reloads keep their own numbers)
+typedef struct {
+    double fetch_ms;        // Reading the file or downloading the URL
+    double decrypt_ms;
+} Source_Timings;
+
+static _Thread_local Source_Timings source_timings;
+
+static double enc_elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
 static void slice(const char *src, char *dst, size_t start, size_t end) {
     if (!src || !dst || start >= end) {
         if (dst) dst[0] = '\0';
@@ -107,7 +124,7 @@ static int base64_char_value(char c) {
 
 unsigned char* base64_decode(const char* data, size_t input_length, size_t* output_length) {
     if (input_length % 4 != 0) {
-        fprintf(stderr, "ERROR: Base64 input length must be multiple of 4\n");
+        source_message(stderr, "ERROR: Base64 input length must be multiple of 4");
         return NULL;
     }
 
@@ -325,16 +342,16 @@ char* decrypt_string(const char* input, const char* key) {
         return empty;
     }
     
-    printf("Decrypting %zu bytes...\n", input_len);
+    source_message(stdout, "Decrypting %zu bytes...", input_len);
     
     // Reverse step 4: base64 decode
     size_t step1_len;
     unsigned char* step1 = base64_decode(input, input_len, &step1_len);
     if (!step1) {
-        fprintf(stderr, "Base64 decode failed\n");
+        source_message(stderr, "Base64 decode failed");
         return NULL;
     }
-    printf("After Base64 decode: %zu bytes\n", step1_len);
+    source_message(stdout, "After Base64 decode: %zu bytes", step1_len);
     
     // Reverse step 3: XOR with inverse of user-provided key
     xor_with_inverse_key(step1, step1_len, key);
@@ -344,10 +361,10 @@ char* decrypt_string(const char* input, const char* key) {
     unsigned char* step2 = base85_decode((char*)step1, step1_len, &step2_len);
     free(step1);
     if (!step2) {
-        fprintf(stderr, "Base85 decode failed\n");
+        source_message(stderr, "Base85 decode failed");
         return NULL;
     }
-    printf("After Base85 decode: %zu bytes\n", step2_len);
+    source_message(stdout, "After Base85 decode: %zu bytes", step2_len);
     
     // Reverse step 1: XOR with user-provided key
     xor_with_key(step2, step2_len, key);
@@ -362,7 +379,7 @@ char* decrypt_string(const char* input, const char* key) {
     result[step2_len] = '\0';
     free(step2);
     
-    printf("Final decrypted: %zu bytes\n", step2_len);
+    source_message(stdout, "Final decrypted: %zu bytes", step2_len);
     return result;
 }
 
@@ -373,19 +390,19 @@ char* decrypt_string(const char* input, const char* key) {
 static char *read_entire_file(const char *filename) {
     FILE *f = fopen(filename, "rb");
     if (!f) {
-        fprintf(stderr, "ERROR: Could not open file '%s'\n", filename);
+        source_message(stderr, "ERROR: Could not open file '%s'", filename);
         return NULL;
     }
     
     if (fseek(f, 0, SEEK_END) != 0) {
-        fprintf(stderr, "ERROR: Could not seek in file '%s'\n", filename);
+        source_message(stderr, "ERROR: Could not seek in file '%s'", filename);
         fclose(f);
         return NULL;
     }
     
     long size = ftell(f);
     if (size < 0) {
-        fprintf(stderr, "ERROR: Could not get file size for '%s'\n", filename);
+        source_message(stderr, "ERROR: Could not get file size for '%s'", filename);
         fclose(f);
         return NULL;
     }
@@ -394,7 +411,7 @@ static char *read_entire_file(const char *filename) {
     
     char *content = malloc(size + 1);
     if (!content) {
-        fprintf(stderr, "ERROR: Out of memory (file size: %ld bytes)\n", size);
+        source_message(stderr, "ERROR: Out of memory (file size: %ld bytes)", size);
         fclose(f);
         return NULL;
     }
@@ -408,13 +425,20 @@ static char *read_entire_file(const char *filename) {
 
 // Unified function to get source code from either file or URL
 char* get_source_code(const char* source_path) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    source_timings = (Source_Timings){0};
+
+    char* source_code;
     if (is_url(source_path)) {
-        printf("Downloading from URL: %s\n", source_path);
-        return download_from_url(source_path);
+        source_message(stdout, "Downloading from URL: %s", source_path);
+        source_code = download_from_url(source_path);
     } else {
-        printf("Reading local file: %s\n", source_path);
-        return read_entire_file(source_path);
+        source_message(stdout, "Reading local file: %s", source_path);
+        source_code = read_entire_file(source_path);
     }
+    source_timings.fetch_ms = enc_elapsed_ms(&start);
+    return source_code;
 }
 
 char* read_enc_dec_managed(char* first_arg, char* second_arg, int argc, int* encryption_mode_p, char* source_path_p){
@@ -444,6 +468,10 @@ char* read_enc_dec_managed(char* first_arg, char* second_arg, int argc, int* enc
         source_path = first_arg;
     }
 
+    // Report the resolved mode and path back to the caller (used by :reload)
+    *encryption_mode_p = encryption_mode;
+    snprintf(source_path_p, 10240, "%s", source_path);
+
     // Get source code (from file or URL)
     source_code = get_source_code(source_path);
     if (!source_code) {
@@ -507,8 +535,12 @@ char* read_enc_dec_managed(char* first_arg, char* second_arg, int argc, int* enc
             exit(1);
         }
         
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
         char* decrypted = decrypt_string(source_code, key);
+        source_timings.decrypt_ms = enc_elapsed_ms(&start);
         free(key);
+        free(source_code);
         
         if (!decrypted) {
             fprintf(stderr, "ERROR: Decryption failed - invalid key or corrupted file\n");
@@ -521,4 +553,29 @@ char* read_enc_dec_managed(char* first_arg, char* second_arg, int argc, int* enc
         source_code = decrypted;
     }
     return source_code;
-}
\ No newline at end of file
+}
+// Fetch (and decrypt, for encryption_mode 0) source_path again without
+// prompting or exiting, for reloads of an already running session. Runs on
+// the reload thread, so its messages go through source_message().
+// Returns NULL on failure.
+char* reload_source(const char* source_path, int encryption_mode, const char* key) {
+    char* source_code = get_source_code(source_path);
+    if (!source_code) {
+        source_message(stderr, "ERROR: Could not retrieve source code from: %s", source_path);
+        return NULL;
+    }
+
+    if (encryption_mode == 0) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        char* decrypted = decrypt_string(source_code, key ? key : "");
+        source_timings.decrypt_ms = enc_elapsed_ms(&start);
+        free(source_code);
+        if (!decrypted) {
+            source_message(stderr, "ERROR: Decryption failed - invalid key or corrupted file");
+            return NULL;
+        }
+        source_code = decrypted;
+    }
+    return source_code;
+}
@@ -6,6 +6,7 @@ Decrypt and compile: ./malcrepl 0 encrypted_file.c
 
 // Define feature test macros before any includes
 // #define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE  // dladdr()
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,6 +18,21 @@ Decrypt and compile: ./malcrepl 0 encrypted_file.c
 #include <sys/stat.h>
 #include <stdint.h>
 #include <signal.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <ucontext.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <limits.h>
+#include <math.h>
+#ifdef __GLIBC__
+#include <malloc.h>     // malloc_trim()
+#endif
 
 #include <unistd.h>
 #include <termios.h>
@@ -44,6 +60,12 @@ Decrypt and compile: ./malcrepl 0 encrypted_file.c
 #include <curl/curl.h>
 // Encryption library
 #include "enclib.h"
+// Compiled image cache
+#include "cachelib.h"
+// Hardware performance counters, perf map / jitdump export
+#include "perflib.h"
+// Allocator hooks for :allocs and :arena
+#include "alloclib.h"
 
 // ============================================================================
 // Signal Handling
@@ -114,6 +136,9 @@ static void setup_signal_handlers(void) {
     sa.sa_flags = 0;
     
     sigaction(SIGINT, &sa, NULL);
+
+    // Child compilers fed through a pipe may exit before reading all of it
+    signal(SIGPIPE, SIG_IGN);
 }
 
 // ============================================================================
@@ -171,30 +196,68 @@ static inline bool sv_eq(String_View a, String_View b) {
     return a.count == b.count && memcmp(a.data, b.data, a.count) == 0;
 }
 
+// If sv starts with prefix, store the trimmed remainder in *rest
+static inline bool sv_chop_prefix(String_View sv, const char *prefix, String_View *rest) {
+    size_t len = strlen(prefix);
+    if (sv.count < len || memcmp(sv.data, prefix, len) != 0) return false;
+    if (rest) *rest = sv_trim((String_View){sv.data + len, sv.count - len});
+    return true;
+}
+
 // ============================================================================
 // Memory Arena
 // ============================================================================
 
-typedef struct Arena_Block {
-    void *memory;
-    struct Arena_Block *next;
-} Arena_Block;
+// Bump allocation out of malloc()ed chunks. A reset keeps the first chunk
+// and frees the rest, so a REPL call whose temporaries fit in it costs no
+// heap allocation at all and resetting is O(1).
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct Arena_Chunk {
+    struct Arena_Chunk *next;
+    size_t capacity;
+    size_t used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+} Arena_Chunk;
 
 typedef struct {
-    Arena_Block *head;
+    Arena_Chunk *first;     // Retained across resets
+    Arena_Chunk *current;   // Last chunk of the list, allocations go here
+    size_t bytes;           // Handed out since the last reset
+    size_t last_bytes;      // ... before the last reset
+    size_t high_water;      // Most bytes between two resets
+    size_t chunks;          // Chunks held right now
+    size_t chunk_allocs;    // malloc() calls for chunks, ever
 } Arena;
 
 static Arena temp_arena = {0};
 
 static void arena_reset(Arena *arena) {
-    Arena_Block *block = arena->head;
-    while (block) {
-        Arena_Block *next = block->next;
-        free(block->memory);
-        free(block);
-        block = next;
+    if (arena->bytes > arena->high_water) arena->high_water = arena->bytes;
+    arena->last_bytes = arena->bytes;
+    arena->bytes = 0;
+    if (!arena->first) return;
+
+    Arena_Chunk *chunk = arena->first->next;
+    while (chunk) {
+        Arena_Chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
-    arena->head = NULL;
+    arena->first->next = NULL;
+    arena->first->used = 0;
+    arena->current = arena->first;
+    arena->chunks = 1;
+}
+
+// Release every chunk, the retained one included
+static void arena_free(Arena *arena) {
+    arena_reset(arena);
+    free(arena->first);
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->chunks = 0;
 }
 
 static void *arena_alloc(Arena *arena, size_t size) {
@@ -202,40 +265,40 @@ static void *arena_alloc(Arena *arena, size_t size) {
         fprintf(stderr, "WARNING: Attempted to allocate 0 bytes\n");
         return NULL;
     }
-
-    void *mem = calloc(1, size);
-    if (!mem) {
+    size_t rounded = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (rounded < size) {
         fprintf(stderr, "ERROR: Out of memory (requested %zu bytes)\n", size);
         return NULL;
     }
 
-    Arena_Block *block = malloc(sizeof(Arena_Block));
-    if (!block) {
-        free(mem);
-        fprintf(stderr, "ERROR: Out of memory for arena block\n");
-        return NULL;
+    Arena_Chunk *chunk = arena->current;
+    if (!chunk || chunk->capacity - chunk->used < rounded) {
+        size_t capacity = rounded > ARENA_CHUNK_SIZE ? rounded : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(Arena_Chunk) + capacity);
+        if (!chunk) {
+            fprintf(stderr, "ERROR: Out of memory (requested %zu bytes)\n", size);
+            return NULL;
+        }
+        chunk->next = NULL;
+        chunk->capacity = capacity;
+        chunk->used = 0;
+        if (arena->current) arena->current->next = chunk;
+        else arena->first = chunk;
+        arena->current = chunk;
+        arena->chunks++;
+        arena->chunk_allocs++;
     }
 
-    block->memory = mem;
-    block->next = arena->head;
-    arena->head = block;
-
+    void *mem = chunk->data + chunk->used;
+    chunk->used += rounded;
+    arena->bytes += rounded;
+    memset(mem, 0, size);   // Callers rely on calloc() semantics
     return mem;
 }
 
-static char *arena_strdup(Arena *arena, const char *str) {
-    size_t len = strlen(str);
-    char *copy = arena_alloc(arena, len + 1);
-    if (copy) {
-        memcpy(copy, str, len + 1);
-    }
-    return copy;
-}
-
 // Legacy temp_* functions
 #define temp_reset() arena_reset(&temp_arena)
 #define temp_alloc(size) arena_alloc(&temp_arena, size)
-#define temp_strdup(str) arena_strdup(&temp_arena, str)
 
 // ============================================================================
 // FFI Type System
@@ -253,16 +316,466 @@ typedef struct {
     size_t capacity;
 } Value_Array;
 
+// ============================================================================
+// Timing
+// ============================================================================
+
+static inline double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Raw monotonic clock (not slewed by NTP) for short intervals
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_RAW
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// ============================================================================
+// Process Helpers
+// ============================================================================
+
+// Run argv[0] (looked up on PATH) with input (if any) on its stdin and wait
+// for it. Returns the exit status, or -1 if it could not be started or was
+// killed.
+static int run_process_input(char *const argv[], const char *input, bool quiet) {
+    int in_pipe[2] = {-1, -1};
+    if (input && pipe(in_pipe) != 0) return -1;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        if (input) {
+            close(in_pipe[0]);
+            close(in_pipe[1]);
+        }
+        return -1;
+    }
+
+    if (pid == 0) {
+        if (input) {
+            dup2(in_pipe[0], STDIN_FILENO);
+            close(in_pipe[0]);
+            close(in_pipe[1]);
+        }
+        if (quiet) {
+            FILE *null_out = freopen("/dev/null", "w", stderr);
+            (void)null_out;
+        }
+        signal(SIGPIPE, SIG_DFL);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    if (input) {
+        close(in_pipe[0]);
+        size_t len = strlen(input);
+        while (len > 0) {
+            ssize_t n = write(in_pipe[1], input, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;  // Child stopped reading; its status tells why
+            input += n;
+            len -= (size_t)n;
+        }
+        close(in_pipe[1]);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int run_process(char *const argv[], bool quiet) {
+    return run_process_input(argv, NULL, quiet);
+}
+
+// Resident set size in bytes from /proc/self/statm (0 if unavailable).
+// Read into a stack buffer: stdio would allocate and fault in its own buffer.
+static size_t resident_memory_bytes(void) {
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    char text[128];
+    ssize_t len;
+    do {
+        len = read(fd, text, sizeof(text) - 1);
+    } while (len < 0 && errno == EINTR);
+    close(fd);
+    if (len <= 0) return 0;
+    text[len] = '\0';
+    unsigned long total_pages, resident_pages;
+    if (sscanf(text, "%lu %lu", &total_pages, &resident_pages) != 2) return 0;
+    return resident_pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// OS-side cost of a stretch of code on this thread: page faults, context
+// switches and memory growth. maxrss is the process-wide high-water mark.
+typedef struct {
+    long minor_faults;
+    long major_faults;
+    long voluntary_switches;
+    long involuntary_switches;
+    long maxrss_kb;
+    long rss_kb;
+} Resource_Usage;
+
+// getrusage() comes last, so the statm read is never charged to the span
+// that starts here
+static void resource_usage_now(Resource_Usage *usage) {
+    struct rusage ru;
+    memset(usage, 0, sizeof(*usage));
+    usage->rss_kb = (long)(resident_memory_bytes() / 1024);
+    if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+        usage->minor_faults = ru.ru_minflt;
+        usage->major_faults = ru.ru_majflt;
+        usage->voluntary_switches = ru.ru_nvcsw;
+        usage->involuntary_switches = ru.ru_nivcsw;
+        usage->maxrss_kb = ru.ru_maxrss;
+    }
+}
+
+// Print what changed between before and after, per call when calls > 1
+static void print_resource_usage(const Resource_Usage *before, const Resource_Usage *after,
+                                 double calls) {
+    int digits = calls > 1 ? 2 : 0;
+    printf("  faults %.*f minor / %.*f major  switches %.*f voluntary / %.*f involuntary%s"
+           "  RSS %+ld KiB (peak %+ld KiB)\n",
+           digits, (after->minor_faults - before->minor_faults) / calls,
+           digits, (after->major_faults - before->major_faults) / calls,
+           digits, (after->voluntary_switches - before->voluntary_switches) / calls,
+           digits, (after->involuntary_switches - before->involuntary_switches) / calls,
+           calls > 1 ? " per call" : "",
+           after->rss_kb - before->rss_kb, after->maxrss_kb - before->maxrss_kb);
+}
+
+// Hand freed heap pages back to the OS. A discarded image is freed in many
+// small blocks, and without this the heap keeps its high-water mark.
+static void release_free_memory(void) {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+// ============================================================================
+// Call-Site Cache
+// ============================================================================
+//
+// Repeated calls of one function with the same argument types reuse the
+// resolved address, detected return type and prepared ffi_cif instead of
+// looking the symbol up, rescanning the source and running ffi_prep_cif()
+// again. Anything that can change what a name resolves to (reload, :def,
+// :load, promotion to the optimizing tier) clears the cache.
+
+#define CALL_CACHE_MIN_CAPACITY 64
+
+// Typed trampoline for one signature (see Direct-Call Stubs)
+typedef void (*Call_Stub)(void *func, void **args, void *result);
+
+typedef struct {
+    char *name;                 // NULL for an empty slot
+    uint64_t hash;
+    ffi_type **arg_types;       // Owned copy; cif.arg_types points here
+    unsigned arg_count;
+    ffi_type *return_type;
+    void *func;
+    size_t tier_index;          // Call statistics entry of the active context
+    ffi_cif cif;
+    Call_Stub stub;             // Direct call, or NULL for ffi_call()
+    bool stub_pending;          // Stub skipped while a reload held TCC; retried
+} Call_Site;
+
+typedef struct {
+    Call_Site *slots;           // Open addressing, linear probing
+    size_t capacity;            // Power of two
+    size_t count;
+    unsigned long hits;
+    unsigned long misses;
+} Call_Cache;
+
+static Call_Cache call_cache = {0};
+
+static uint64_t call_site_hash(const char *name, ffi_type **types, size_t count) {
+    uint64_t hash = fnv1a64_str(FNV1A64_INIT, name);
+    return fnv1a64(hash, types, count * sizeof(*types));
+}
+
+static Call_Site *call_cache_lookup(const char *name, ffi_type **types, size_t count) {
+    if (call_cache.count > 0) {
+        uint64_t hash = call_site_hash(name, types, count);
+        size_t mask = call_cache.capacity - 1;
+        for (size_t i = hash & mask; call_cache.slots[i].name; i = (i + 1) & mask) {
+            Call_Site *site = &call_cache.slots[i];
+            if (site->hash == hash && site->arg_count == count &&
+                strcmp(site->name, name) == 0 &&
+                memcmp(site->arg_types, types, count * sizeof(*types)) == 0) {
+                call_cache.hits++;
+                return site;
+            }
+        }
+    }
+    call_cache.misses++;
+    return NULL;
+}
+
+static bool call_cache_grow(void) {
+    size_t capacity = call_cache.capacity ? call_cache.capacity * 2 : CALL_CACHE_MIN_CAPACITY;
+    Call_Site *slots = calloc(capacity, sizeof(Call_Site));
+    if (!slots) return false;
+
+    for (size_t i = 0; i < call_cache.capacity; i++) {
+        Call_Site *site = &call_cache.slots[i];
+        if (!site->name) continue;
+        size_t j = site->hash & (capacity - 1);
+        while (slots[j].name) j = (j + 1) & (capacity - 1);
+        slots[j] = *site;  // cif.arg_types points at the heap copy, so moving is fine
+    }
+    free(call_cache.slots);
+    call_cache.slots = slots;
+    call_cache.capacity = capacity;
+    return true;
+}
+
+// Prepare a call site and remember it. On failure returns NULL and stores
+// the ffi_prep_cif() status in *status.
+static Call_Site *call_cache_insert(const char *name, ffi_type **types, size_t count,
+                                    ffi_type *return_type, void *func, size_t tier_index,
+                                    ffi_status *status) {
+    *status = FFI_OK;
+    if ((call_cache.count + 1) * 4 > call_cache.capacity * 3 && !call_cache_grow()) {
+        *status = FFI_BAD_TYPEDEF;
+        return NULL;
+    }
+
+    uint64_t hash = call_site_hash(name, types, count);
+    size_t mask = call_cache.capacity - 1;
+    size_t i = hash & mask;
+    while (call_cache.slots[i].name) i = (i + 1) & mask;
+
+    Call_Site *site = &call_cache.slots[i];
+    site->arg_types = malloc((count ? count : 1) * sizeof(*types));
+    site->name = strdup(name);
+    if (!site->arg_types || !site->name) {
+        free(site->arg_types);
+        free(site->name);
+        memset(site, 0, sizeof(*site));
+        *status = FFI_BAD_TYPEDEF;
+        return NULL;
+    }
+    if (count) memcpy(site->arg_types, types, count * sizeof(*types));
+    site->hash = hash;
+    site->arg_count = (unsigned)count;
+    site->return_type = return_type;
+    site->func = func;
+    site->tier_index = tier_index;
+
+    *status = ffi_prep_cif(&site->cif, FFI_DEFAULT_ABI, site->arg_count,
+                           return_type, site->arg_types);
+    if (*status != FFI_OK) {
+        free(site->arg_types);
+        free(site->name);
+        memset(site, 0, sizeof(*site));
+        return NULL;
+    }
+    call_cache.count++;
+    return site;
+}
+
+// Forget every call site (capacity is kept)
+static void call_cache_clear(void) {
+    for (size_t i = 0; i < call_cache.capacity; i++) {
+        free(call_cache.slots[i].name);
+        free(call_cache.slots[i].arg_types);
+    }
+    if (call_cache.slots) memset(call_cache.slots, 0, call_cache.capacity * sizeof(Call_Site));
+    call_cache.count = 0;
+}
+
+static void call_cache_free(void) {
+    call_cache_clear();
+    free(call_cache.slots);
+    call_cache.slots = NULL;
+    call_cache.capacity = 0;
+}
+
 // ============================================================================
 // TCC Compilation
 // ============================================================================
 
+#ifndef MALCREPL_TCC_VERSION
+#define MALCREPL_TCC_VERSION "unknown"
+#endif
+
+// Per-function call statistics for the optimizing tier
+typedef struct {
+    char *name;
+    unsigned long calls;
+    double total_ms;
+    void *optimized;        // Entry point in the optimized image once promoted
+    bool failed;            // Promotion failed; don't retry for this image
+} Tier_Entry;
+
+typedef struct {
+    Tier_Entry *items;
+    size_t count;
+    size_t capacity;
+} Tier_Array;
+
+typedef struct {
+    char **items;
+    size_t count;
+    size_t capacity;
+} String_Array;
+
+// A definition added at the prompt with :def (see Incremental Definitions)
+typedef struct {
+    TCCState *state;        // Relocated in-memory unit
+    char *source;
+    String_Array names;     // Names it defines
+} Delta_Unit;
+
+typedef struct {
+    Delta_Unit *items;
+    size_t count;
+    size_t capacity;
+} Delta_Array;
+
+#define MARSHAL_MAX_ARGS 16
+
+// Declared parameter layout of a function (see Argument Marshalling)
+typedef struct {
+    bool known;             // Every parameter type was understood
+    unsigned count;
+    ffi_type *types[MARSHAL_MAX_ARGS];
+    size_t offsets[MARSHAL_MAX_ARGS];   // Into block
+    unsigned char *block;   // Argument values of the call in progress
+} Marshal_Plan;
+
+// One file-scope definition of the image or a :def unit (see Symbol Index)
+typedef struct {
+    char *name;
+    void *addr;
+    size_t size;            // Bytes, 0 when unknown
+    bool size_exact;        // From the ELF symbol; otherwise an upper bound
+    bool is_function;
+    unsigned unit;          // 0 = image, n = nth :def unit
+    char *signature;        // Functions only
+    Marshal_Plan plan;
+} Symbol_Info;
+
+typedef struct {
+    Symbol_Info *items;     // Sorted by name
+    size_t count;
+    size_t capacity;
+    bool built;
+} Symbol_Index;
+
+// Where the time of one compile went (:compile-stats). Stages that didn't
+// run stay at zero.
+typedef struct {
+    double fetch_ms;        // Reading / downloading the source
+    double decrypt_ms;
+    double snapshot_ms;     // Locating (or building) the header snapshot
+    double configure_ms;    // Include paths and libraries
+    double compile_ms;      // tcc_compile_string(): preprocessing + code generation
+    double retry_ms;        // Snapshot attempt discarded before the real-header compile
+    double relocate_ms;     // tcc_relocate(), or writing / linking the shared object
+    double load_ms;         // dlopen() of a cached image
+    double total_ms;        // Fetch to usable image
+    const char *kind;       // How the image was produced
+} Compile_Stats;
+
+// Image cache outcome of one compile, or session totals (cache_stats)
+typedef struct {
+    unsigned hits;
+    unsigned misses;
+    double saved_ms;        // Sum of (recorded compile time - load time) on hits
+    double last_ms;         // Time taken to produce the current image
+    bool last_hit;
+    bool last_snapshot;     // Current image was compiled against the header snapshot
+} Cache_Stats;
+
 typedef struct {
     TCCState *state;
+    void *image_handle;     // dlopen()ed cached image (state is NULL then)
+    char *image_path;
+    bool image_private;     // Loaded from a copy that is already deleted
     char *source_path;
     char *source_code;
+    Tier_Array tier;
+    void *tier_handle;      // Optimized image, built on the first promotion
+    char *tier_path;
+    bool tier_failed;       // Optimizing compiler missing or rejected the source
+    Compile_Stats stats;
+    Cache_Stats cache;      // Counted into cache_stats when installed
+    Delta_Array deltas;     // :def units, oldest first
+    Symbol_Index symbols;   // Built lazily, reset whenever the units change
+    bool alloc_hooked;      // Linked against the allocator hooks (:allocs, :arena)
 } Compiler_Context;
 
+// Image cache statistics of the session (shown by :info). Only the main
+// thread touches them: a compile records its own outcome in compile_cache on
+// whichever thread runs it, compile_source() moves that into the context, and
+// cache_stats_publish() adds it here once the context is installed.
+static Cache_Stats cache_stats = {0};
+static _Thread_local Cache_Stats compile_cache;
+
+static void cache_stats_publish(const Cache_Stats *image) {
+    cache_stats.hits += image->hits;
+    cache_stats.misses += image->misses;
+    cache_stats.saved_ms += image->saved_ms;
+    cache_stats.last_ms = image->last_ms;
+    cache_stats.last_hit = image->last_hit;
+    cache_stats.last_snapshot = image->last_snapshot;
+}
+
+// Stages of the compile running on this thread, moved into the context at
+// the end of compile_source()
+static _Thread_local Compile_Stats compile_stats;
+
+// System include paths, in search order
+static const char *system_include_paths[] = {
+    "/usr/include",
+    "/usr/local/include",
+#if defined(__x86_64__) || defined(__amd64__)
+    "/usr/include/x86_64-linux-gnu",
+#elif defined(__aarch64__)
+    "/usr/include/aarch64-linux-gnu",
+#endif
+    NULL
+};
+
+// Libraries linked into every compiled source
+static const char *default_libraries[] = {
+    "c",
+    "m",    // Math (optional, needed for test example)
+    NULL
+};
+
+// Prebuilt artifacts attached with :load / --load
+typedef struct {
+    char *path;             // Absolute path
+    void *handle;           // Shared objects are dlopen()ed RTLD_GLOBAL; NULL for .a/.o
+} Loaded_Library;
+
+typedef struct {
+    Loaded_Library *items;
+    size_t count;
+    size_t capacity;
+} Library_Array;
+
+static Library_Array loaded_libraries = {0};
+
+// New in-memory images are linked against the allocator hooks (:allocs or
+// :arena on). Only changed on the main thread while no reload runs (the
+// reload thread reads it).
+static bool alloc_hooks = false;
+
 // Find TCC's include directory (cached result)
 static const char *find_tcc_include_path(void) {
     static const char *cached_path = NULL;
@@ -293,11 +806,365 @@ static const char *find_tcc_include_path(void) {
     return NULL;
 }
 
+// Directory part of source_path ("" when it has none)
+static void source_directory(const char *source_path, char *dir, size_t size) {
+    dir[0] = '\0';
+    if (!source_path) return;
+    const char *last_slash = strrchr(source_path, '/');
+    if (last_slash) {
+        snprintf(dir, size, "%.*s", (int)(last_slash - source_path), source_path);
+    }
+}
+
+// Collects TCC diagnostics instead of letting them go straight to stderr
+typedef struct {
+    char *items;
+    size_t count;
+    size_t capacity;
+} Error_Log;
+
+static void error_log_append(void *opaque, const char *msg) {
+    Error_Log *log = opaque;
+    for (const char *p = msg; *p; p++) {
+        da_append(log, *p);
+    }
+    da_append(log, '\n');
+}
+
+static void error_log_flush(Error_Log *log, FILE *out) {
+    if (log->count > 0) {
+        fwrite(log->items, 1, log->count, out);
+    }
+    log->count = 0;
+}
+
+// Compile diagnostics of the current thread go here when set (background
+// reloads collect them for the REPL to show), otherwise to stderr
+static _Thread_local Error_Log *diag_sink = NULL;
+
+static void compile_diag(const char *fmt, ...) {
+    char msg[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+
+    if (diag_sink) {
+        error_log_append(diag_sink, msg);
+    } else {
+        fprintf(stderr, "%s\n", msg);
+    }
+}
+
+// TCC 0.9.x keeps compiler state in globals (and tcc_delete() resets them),
+// so every TCC call that creates, compiles or deletes a state is serialized.
+// Held from tcc_new() to the last call on that state only: hashing, file
+// and cache I/O and worker processes run outside it, so the main thread
+// isn't stalled for a whole background compile.
+// Recursive because compile paths destroy scratch contexts while holding it.
+static pthread_mutex_t tcc_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static TCCState *tcc_new_state(void) {
+    TCCState *state = tcc_new();
+    if (state && diag_sink) {
+        tcc_set_error_func(state, diag_sink, error_log_append);
+    }
+    return state;
+}
+
+// Bytes from addr to the end of the mapping that holds it (0 if unknown)
+static size_t mapping_bytes_after(const void *addr) {
+    FILE *f = fopen("/proc/self/maps", "r");
+    if (!f) return 0;
+    uintptr_t at = (uintptr_t)addr;
+    size_t bytes = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long low, high;
+        if (sscanf(line, "%lx-%lx", &low, &high) == 2 && at >= low && at < high) {
+            bytes = high - at;
+            break;
+        }
+    }
+    fclose(f);
+    return bytes;
+}
+
+// Length of a TCC-compiled function, which libtcc doesn't report (0 if
+// unknown). On x86_64 TCC ends every function with a single leave; ret
+// epilogue that all returns jump to, so the first c9 c3 pair bounds it.
+// Those bytes can also occur inside an instruction and cut the size short,
+// so this is only good enough for naming code in perf, never for the index.
+// The scan stops after limit bytes (the next known symbol), or at the end
+// of the mapping when limit is 0.
+#define TCC_CODE_SCAN_LIMIT (1 << 20)
+
+static size_t tcc_code_size(const void *addr, size_t limit) {
+#if defined(__x86_64__)
+    if (!addr) return 0;
+    size_t mapped = mapping_bytes_after(addr);
+    if (limit == 0 || limit > mapped) limit = mapped;
+    if (limit > TCC_CODE_SCAN_LIMIT) limit = TCC_CODE_SCAN_LIMIT;
+    const unsigned char *code = addr;
+    for (size_t i = 0; i + 1 < limit; i++) {
+        if (code[i] == 0xc9 && code[i + 1] == 0xc3) return i + 2;
+    }
+#else
+    (void)addr; (void)limit;
+#endif
+    return 0;
+}
+
+// ============================================================================
+// System Header Snapshot
+// ============================================================================
+//
+// TCC has no precompiled headers, so the closest equivalent is a flattened
+// copy of the common libc headers: `tcc -E -dD` resolves every nested include
+// and conditional once per host, keeping the macro definitions. Shim headers
+// named after the originals point at the snapshot, and its directory is put
+// first on the include path, so `#include <stdio.h>` reads one pre-resolved
+// file instead of walking dozens of system headers.
+
+static const char *snapshot_headers[] = {
+    "stdio.h",
+    "stdlib.h",
+    "string.h",
+    "math.h",
+    NULL
+};
+
+#define SNAPSHOT_FILE "malcrepl_std.h"
+#define SNAPSHOT_GUARD "MALCREPL_STD_SNAPSHOT"
+
+// Compile a probe against the snapshot to make sure TCC accepts it
+static bool header_snapshot_valid(const char *dir) {
+    pthread_mutex_lock(&tcc_lock);
+    TCCState *s = tcc_new();
+    if (!s) {
+        pthread_mutex_unlock(&tcc_lock);
+        return false;
+    }
+
+    Error_Log log = {0};
+    tcc_set_error_func(s, &log, error_log_append);
+    tcc_set_output_type(s, TCC_OUTPUT_MEMORY);
+    tcc_add_include_path(s, dir);
+    const char *tcc_include = find_tcc_include_path();
+    if (tcc_include) tcc_add_include_path(s, tcc_include);
+    for (int i = 0; system_include_paths[i] != NULL; i++) {
+        tcc_add_include_path(s, system_include_paths[i]);
+    }
+
+    bool ok = tcc_compile_string(s,
+        "#include <stdio.h>\n"
+        "#include <stdlib.h>\n"
+        "#include <string.h>\n"
+        "#include <math.h>\n"
+        "#ifndef " SNAPSHOT_GUARD "\n"
+        "#error snapshot not used\n"
+        "#endif\n"
+        "int malcrepl_snapshot_probe(void) {\n"
+        "    FILE *f = stdout;\n"
+        "    return (f != NULL) + EOF + (int)strlen(\"x\") + abs(-1) + (int)sqrt(4.0);\n"
+        "}\n") != -1;
+
+    tcc_delete(s);
+    pthread_mutex_unlock(&tcc_lock);
+    da_free(&log);
+    return ok;
+}
+
+static bool write_text_file(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    bool ok = fputs(text, f) >= 0;
+    return (fclose(f) == 0) && ok;
+}
+
+static bool build_header_snapshot(const char *dir) {
+    char src_path[4096 + 32], raw_path[4096 + 32], out_path[4096 + 32];
+    snprintf(src_path, sizeof(src_path), "%s/snapshot_src.c", dir);
+    snprintf(raw_path, sizeof(raw_path), "%s/snapshot.i", dir);
+    snprintf(out_path, sizeof(out_path), "%s/" SNAPSHOT_FILE, dir);
+
+    if (!make_directories(dir)) return false;
+
+    // Translation unit that pulls in every snapshot header
+    char include_list[1024] = "";
+    for (int i = 0; snapshot_headers[i] != NULL; i++) {
+        size_t used = strlen(include_list);
+        snprintf(include_list + used, sizeof(include_list) - used,
+                 "#include <%s>\n", snapshot_headers[i]);
+    }
+    if (!write_text_file(src_path, include_list)) return false;
+
+    // Preprocess with the same include paths compiler_configure() uses
+    char *argv[32];
+    int argc = 0;
+    char include_args[16][4096 + 2];
+    int n_includes = 0;
+
+    argv[argc++] = "tcc";
+    argv[argc++] = "-E";
+    argv[argc++] = "-P";
+    argv[argc++] = "-dD";
+    const char *tcc_include = find_tcc_include_path();
+    if (tcc_include) {
+        snprintf(include_args[n_includes], sizeof(include_args[0]), "-I%s", tcc_include);
+        argv[argc++] = include_args[n_includes++];
+    }
+    for (int i = 0; system_include_paths[i] != NULL && n_includes < 16; i++) {
+        snprintf(include_args[n_includes], sizeof(include_args[0]), "-I%s", system_include_paths[i]);
+        argv[argc++] = include_args[n_includes++];
+    }
+    argv[argc++] = "-o";
+    argv[argc++] = raw_path;
+    argv[argc++] = src_path;
+    argv[argc] = NULL;
+
+    int status = run_process(argv, true);
+    unlink(src_path);
+    if (status != 0) {
+        unlink(raw_path);
+        return false;
+    }
+
+    // Wrap the flattened output in a guard so the shims can share it
+    char *flattened = read_entire_file(raw_path);
+    unlink(raw_path);
+    if (!flattened) return false;
+
+    FILE *out = fopen(out_path, "w");
+    if (!out) {
+        free(flattened);
+        return false;
+    }
+    fprintf(out, "#ifndef " SNAPSHOT_GUARD "\n#define " SNAPSHOT_GUARD " 1\n");
+    fputs(flattened, out);
+    fprintf(out, "\n#endif\n");
+    free(flattened);
+    if (fclose(out) != 0) {
+        unlink(out_path);
+        return false;
+    }
+
+    for (int i = 0; snapshot_headers[i] != NULL; i++) {
+        char shim_path[4096 + 32];
+        snprintf(shim_path, sizeof(shim_path), "%s/%s", dir, snapshot_headers[i]);
+        if (!write_text_file(shim_path, "#include \"" SNAPSHOT_FILE "\"\n")) {
+            unlink(out_path);
+            return false;
+        }
+    }
+
+    if (!header_snapshot_valid(dir)) {
+        unlink(out_path);
+        return false;
+    }
+    return true;
+}
+
+// Snapshot directory for this host (built on first use, cached result).
+// Keyed by TCC version, include paths and the top-level headers' mtime/size
+// so a libc upgrade produces a fresh snapshot.
+static const char *header_snapshot_resolve(void) {
+    static char dir[4096];
+    static bool resolved = false;
+    static bool available = false;
+
+    if (resolved) return available ? dir : NULL;
+    resolved = true;
+
+    if (getenv("MALCREPL_NO_HEADER_SNAPSHOT")) return NULL;
+    const char *cache = cache_dir();
+    if (!cache) return NULL;
+
+    uint64_t key = FNV1A64_INIT;
+    key = fnv1a64_str(key, MALCREPL_TCC_VERSION);
+    key = fnv1a64_str(key, find_tcc_include_path());
+    for (int i = 0; system_include_paths[i] != NULL; i++) {
+        key = fnv1a64_str(key, system_include_paths[i]);
+    }
+    for (int i = 0; snapshot_headers[i] != NULL; i++) {
+        for (int j = 0; system_include_paths[j] != NULL; j++) {
+            char path[4096];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/%s", system_include_paths[j], snapshot_headers[i]);
+            if (stat(path, &st) == 0) {
+                key = fnv1a64_str(key, path);
+                key = fnv1a64(key, &st.st_mtime, sizeof(st.st_mtime));
+                key = fnv1a64(key, &st.st_size, sizeof(st.st_size));
+                break;
+            }
+        }
+    }
+
+    int n = snprintf(dir, sizeof(dir), "%s/headers-%016llx", cache, (unsigned long long)key);
+    if (n < 0 || (size_t)n >= sizeof(dir)) return NULL;
+
+    char marker[4096 + 32];
+    snprintf(marker, sizeof(marker), "%s/" SNAPSHOT_FILE, dir);
+    if (access(marker, R_OK) == 0) {
+        available = true;
+        return dir;
+    }
+
+    // A previous attempt on this host failed; don't pay for it every launch
+    char failed[4096 + 32];
+    snprintf(failed, sizeof(failed), "%s/failed", dir);
+    if (access(failed, F_OK) == 0) return NULL;
+
+    printf("Building system header snapshot...\n");
+    double start = now_ms();
+    if (!build_header_snapshot(dir)) {
+        compile_diag("WARNING: Could not build system header snapshot, using system headers");
+        if (make_directories(dir)) write_text_file(failed, "");
+        return NULL;
+    }
+    printf("Header snapshot ready in %.2f ms: %s\n", now_ms() - start, dir);
+
+    available = true;
+    return dir;
+}
+
+// Resolved (and built, the first time) outside tcc_lock by compile_source(),
+// so a main-thread TCC call doesn't wait for the snapshot build
+static const char *header_snapshot_dir(void) {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&lock);
+    const char *dir = header_snapshot_resolve();
+    pthread_mutex_unlock(&lock);
+    return dir;
+}
+
+// The snapshot is only equivalent to the real headers when the source pulls
+// in one of them and doesn't change their meaning with feature-test macros
+static bool source_wants_snapshot(const char *source_code) {
+    if (!source_code) return false;
+
+    const char *p = source_code;
+    while ((p = strstr(p, "#define")) != NULL) {
+        p += 7;
+        while (*p == ' ' || *p == '\t') p++;
+        const char *name = p;
+        while (*p == '_' || isalnum((unsigned char)*p)) p++;
+        if (p - name > 7 && memcmp(p - 7, "_SOURCE", 7) == 0) return false;
+    }
+
+    for (int i = 0; snapshot_headers[i] != NULL; i++) {
+        char pattern[64];
+        snprintf(pattern, sizeof(pattern), "<%s>", snapshot_headers[i]);
+        if (strstr(source_code, pattern)) return true;
+    }
+    return false;
+}
+
 static Compiler_Context *compiler_create(void) {
     Compiler_Context *ctx = calloc(1, sizeof(Compiler_Context));
     if (!ctx) return NULL;
 
-    ctx->state = tcc_new();
+    ctx->state = tcc_new_state();
     if (!ctx->state) {
         free(ctx);
         return NULL;
@@ -307,9 +1174,42 @@ static Compiler_Context *compiler_create(void) {
     return ctx;
 }
 
+static void string_array_free(String_Array *strings) {
+    for (size_t i = 0; i < strings->count; i++) free(strings->items[i]);
+    da_free(strings);
+}
+
+static void delta_unit_free(Delta_Unit *delta) {
+    if (delta->state) tcc_delete(delta->state);
+    free(delta->source);
+    string_array_free(&delta->names);
+}
+
+static void symbol_index_reset(Symbol_Index *index) {
+    for (size_t i = 0; i < index->count; i++) {
+        free(index->items[i].name);
+        free(index->items[i].signature);
+        free(index->items[i].plan.block);
+    }
+    index->count = 0;
+    index->built = false;
+}
+
 static void compiler_destroy(Compiler_Context *ctx) {
     if (!ctx) return;
+    pthread_mutex_lock(&tcc_lock);
     if (ctx->state) tcc_delete(ctx->state);
+    for (size_t i = 0; i < ctx->deltas.count; i++) delta_unit_free(&ctx->deltas.items[i]);
+    pthread_mutex_unlock(&tcc_lock);
+    da_free(&ctx->deltas);
+    symbol_index_reset(&ctx->symbols);
+    da_free(&ctx->symbols);
+    if (ctx->image_handle) dlclose(ctx->image_handle);
+    if (ctx->tier_handle) dlclose(ctx->tier_handle);
+    for (size_t i = 0; i < ctx->tier.count; i++) free(ctx->tier.items[i].name);
+    da_free(&ctx->tier);
+    free(ctx->tier_path);
+    free(ctx->image_path);
     free(ctx->source_path);
     free(ctx->source_code);
     free(ctx);
@@ -320,7 +1220,7 @@ static void cleanup_resources(Compiler_Context *compiler, Type_Array *types,
     if (compiler) compiler_destroy(compiler);
     da_free(types);
     da_free(values);
-    temp_reset();
+    arena_free(&temp_arena);
 
     if (encryption_mode == 0) {
         free(source_code); // Free decrypted content
@@ -330,30 +1230,30 @@ static void cleanup_resources(Compiler_Context *compiler, Type_Array *types,
     // Note: encryption_mode == 1 already returns early, so no free needed
 }
 
-static bool compiler_configure(Compiler_Context *ctx, const char *source_path) {
+static bool compiler_configure(Compiler_Context *ctx, const char *source_path, int output_type,
+                               const char *snapshot_dir) {
     if (!ctx || !ctx->state) return false;
 
-    tcc_set_output_type(ctx->state, TCC_OUTPUT_MEMORY);
+    tcc_set_output_type(ctx->state, output_type);
+
+    // Header snapshot shims must shadow the real system headers
+    if (snapshot_dir) {
+        tcc_add_include_path(ctx->state, snapshot_dir);
+    }
 
     // Add TCC's include path (cached lookup)
     const char *tcc_include = find_tcc_include_path();
     if (tcc_include) {
         tcc_add_include_path(ctx->state, tcc_include);
     } else {
-        fprintf(stderr, "WARNING: TCC include directory not found\n");
-        fprintf(stderr, "         Install: sudo apt-get install tcc\n\n");
+        compile_diag("WARNING: TCC include directory not found\n"
+                     "         Install: sudo apt-get install tcc\n");
     }
 
-    // Add system include paths
-    tcc_add_include_path(ctx->state, "/usr/include");
-    tcc_add_include_path(ctx->state, "/usr/local/include");
-
-    // Add architecture-specific includes (conditional compilation could optimize this)
-#if defined(__x86_64__) || defined(__amd64__)
-    tcc_add_include_path(ctx->state, "/usr/include/x86_64-linux-gnu");
-#elif defined(__aarch64__)
-    tcc_add_include_path(ctx->state, "/usr/include/aarch64-linux-gnu");
-#endif
+    // Add system and architecture-specific include paths
+    for (int i = 0; system_include_paths[i] != NULL; i++) {
+        tcc_add_include_path(ctx->state, system_include_paths[i]);
+    }
 
     // Add source directory for local includes
     if (source_path) {
@@ -366,843 +1266,4096 @@ static bool compiler_configure(Compiler_Context *ctx, const char *source_path) {
         }
     }
 
-    // Link standard library
-    tcc_add_library(ctx->state, "c");
+    // Link standard libraries and :load-ed artifacts (objects are linked
+    // later, as a whole)
+    if (output_type != TCC_OUTPUT_OBJ) {
+        for (int i = 0; default_libraries[i] != NULL; i++) {
+            tcc_add_library(ctx->state, default_libraries[i]);
+        }
+        for (size_t i = 0; i < loaded_libraries.count; i++) {
+            if (tcc_add_file(ctx->state, loaded_libraries.items[i].path) == -1) {
+                compile_diag("ERROR: Could not link '%s'", loaded_libraries.items[i].path);
+                return false;
+            }
+        }
+    }
 
-    // Link math (optional, needed for test example)
-    tcc_add_library(ctx->state, "m");
+    // Symbols added here take precedence over the C library's
+    if (alloc_hooks && output_type == TCC_OUTPUT_MEMORY) {
+        tcc_add_symbol(ctx->state, "malloc", (void *)alloc_hook_malloc);
+        tcc_add_symbol(ctx->state, "calloc", (void *)alloc_hook_calloc);
+        tcc_add_symbol(ctx->state, "realloc", (void *)alloc_hook_realloc);
+        tcc_add_symbol(ctx->state, "free", (void *)alloc_hook_free);
+        ctx->alloc_hooked = true;
+    }
 
     return true;
 }
 
-static bool compiler_compile_string(Compiler_Context *ctx, const char *source_code) {
+// Configure ctx and compile source_code into it, preferring the system header
+// snapshot. If the snapshot can't compile this source, start over on a fresh
+// state with the real headers so the user sees the genuine diagnostics.
+static bool compiler_build(Compiler_Context *ctx, const char *source_code,
+                           const char *source_path, int output_type) {
     if (!ctx || !ctx->state || !source_code) return false;
 
-    if (tcc_compile_string(ctx->state, source_code) == -1) {
-        fprintf(stderr, "ERROR: Compilation failed\n");
-        return false;
+    double start = now_ms();
+    const char *snapshot_dir = source_wants_snapshot(source_code) ? header_snapshot_dir() : NULL;
+    compile_stats.snapshot_ms += now_ms() - start;
+    if (snapshot_dir) {
+        Error_Log log = {0};
+        tcc_set_error_func(ctx->state, &log, error_log_append);
+        start = now_ms();
+        bool configured = compiler_configure(ctx, source_path, output_type, snapshot_dir);
+        double configured_at = now_ms();
+        if (configured && tcc_compile_string(ctx->state, source_code) != -1) {
+            compile_stats.configure_ms += configured_at - start;
+            compile_stats.compile_ms += now_ms() - configured_at;
+            // Replay warnings
+            if (diag_sink) {
+                for (size_t i = 0; i < log.count; i++) da_append(diag_sink, log.items[i]);
+            } else {
+                error_log_flush(&log, stderr);
+            }
+            da_free(&log);
+            // log dies with this frame; relocation errors go where tcc_new_state() sends them
+            tcc_set_error_func(ctx->state, diag_sink, diag_sink ? error_log_append : NULL);
+            compile_cache.last_snapshot = true;
+            return true;
+        }
+        da_free(&log);
+
+        tcc_delete(ctx->state);
+        free(ctx->source_path);
+        ctx->source_path = NULL;
+        ctx->state = tcc_new_state();
+        compile_stats.retry_ms += now_ms() - start;
+        if (!ctx->state) return false;
     }
 
-    if (tcc_relocate(ctx->state, TCC_RELOCATE_AUTO) < 0) {
-        fprintf(stderr, "ERROR: Relocation failed - check for undefined symbols\n");
-        return false;
-    }
-
-    return true;
+    compile_cache.last_snapshot = false;
+    start = now_ms();
+    if (!compiler_configure(ctx, source_path, output_type, NULL)) return false;
+    double configured_at = now_ms();
+    compile_stats.configure_ms += configured_at - start;
+    bool ok = tcc_compile_string(ctx->state, source_code) != -1;
+    compile_stats.compile_ms += now_ms() - configured_at;
+    return ok;
 }
 
-static inline void *compiler_get_symbol(Compiler_Context *ctx, const char *name) {
-    return (ctx && ctx->state && name) ? tcc_get_symbol(ctx->state, name) : NULL;
-}
+static bool compiler_compile_string(Compiler_Context *ctx, const char *source_code,
+                                    const char *source_path) {
+    if (!ctx || !ctx->state || !source_code) return false;
 
-Compiler_Context* compile(char* source_code, char *source_path){
-    Compiler_Context *compiler = compiler_create();
-    if (!compiler) {
-        fprintf(stderr, "ERROR: Could not create compiler context\n");
-        free(source_code);
-        exit(1);
+    if (!compiler_build(ctx, source_code, source_path, TCC_OUTPUT_MEMORY)) {
+        compile_diag("ERROR: Compilation failed");
+        return false;
     }
 
-    if (!compiler_configure(compiler, source_path)) {
-        fprintf(stderr, "ERROR: Could not configure compiler\n");
-        free(source_code);
-        compiler_destroy(compiler);
-        exit(1);
+    double start = now_ms();
+    int relocated = tcc_relocate(ctx->state, TCC_RELOCATE_AUTO);
+    compile_stats.relocate_ms += now_ms() - start;
+    if (relocated < 0) {
+        compile_diag("ERROR: Relocation failed - check for undefined symbols");
+        return false;
     }
 
-    // Compile source
-    if (!compiler_compile_string(compiler, source_code)) {
-        fprintf(stderr, "ERROR: Failed to compile '%s'\n", source_path);
-        free(source_code);
-        compiler_destroy(compiler);
-        exit(1);
-    }
+    return true;
+}
 
-    return compiler;
+// dlsym() also searches the image's dependencies (libc, libm, ...), so only
+// report symbols the image itself defines, matching tcc_get_symbol()
+static void *image_get_symbol(void *handle, const char *image_path, const char *name) {
+    void *sym = dlsym(handle, name);
+    if (!sym) return NULL;
+
+    Dl_info info;
+    if (!dladdr(sym, &info) || !info.dli_fname ||
+        strcmp(info.dli_fname, image_path) != 0) {
+        return NULL;
+    }
+    return sym;
 }
 
-// ============================================================================
-// Argument Parsing
-// ============================================================================
+// Symbol defined by the compiled source itself
+static inline void *compiler_image_symbol(Compiler_Context *ctx, const char *name) {
+    if (!ctx || !name) return NULL;
+    if (ctx->image_handle) return image_get_symbol(ctx->image_handle, ctx->image_path, name);
+    return ctx->state ? tcc_get_symbol(ctx->state, name) : NULL;
+}
 
-static bool parse_arguments(stb_lexer *l, Type_Array *types, Value_Array *values) {
-    while (stb_c_lexer_get_token(l)) {
-        switch (l->token) {
-            case CLEX_intlit: {
-                // Check suffix for long (L or LL)
-                const char *p = l->where_firstchar;
-                while (*p && (isdigit(*p) || *p == 'x' || *p == 'X' ||
-                             (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F'))) {
-                    p++;
-                }
+// Symbol exported by a :load-ed shared object
+static void *library_get_symbol(const char *name) {
+    for (size_t i = loaded_libraries.count; i-- > 0; ) {
+        Loaded_Library *lib = &loaded_libraries.items[i];
+        if (!lib->handle) continue;
+        void *sym = image_get_symbol(lib->handle, lib->path, name);
+        if (sym) return sym;
+    }
+    return NULL;
+}
 
-                if (*p == 'L' || *p == 'l') {
-                    da_append(types, &ffi_type_slong);
-                    long *x = temp_alloc(sizeof(long));
-                    if (!x) return false;
-                    *x = l->int_number;
-                    da_append(values, x);
-                } else {
-                    da_append(types, &ffi_type_sint32);
-                    int *x = temp_alloc(sizeof(int));
-                    if (!x) return false;
-                    *x = (int)l->int_number;
-                    da_append(values, x);
-                }
-                break;
-            }
+// Newest :def unit defining name, or NULL
+static Delta_Unit *delta_find(Compiler_Context *ctx, const char *name) {
+    for (size_t i = ctx->deltas.count; i-- > 0; ) {
+        Delta_Unit *delta = &ctx->deltas.items[i];
+        for (size_t j = 0; j < delta->names.count; j++) {
+            if (strcmp(delta->names.items[j], name) == 0) return delta;
+        }
+    }
+    return NULL;
+}
 
-            case CLEX_dqstring: {
-                da_append(types, &ffi_type_pointer);
-                char **x = temp_alloc(sizeof(char*));
-                if (!x) return false;
-                *x = temp_strdup(l->string);
-                if (!*x) return false;
-                da_append(values, x);
-                break;
-            }
+// Definitions made at the prompt shadow the image, which shadows libraries
+static inline void *compiler_get_symbol(Compiler_Context *ctx, const char *name) {
+    if (!ctx || !name) return NULL;
+    Delta_Unit *delta = delta_find(ctx, name);
+    if (delta) return tcc_get_symbol(delta->state, name);
+    void *sym = compiler_image_symbol(ctx, name);
+    return sym ? sym : library_get_symbol(name);
+}
 
-            case CLEX_sqstring: {
-                if (l->string[0] && !l->string[1]) {  // Exactly one char
-                    da_append(types, &ffi_type_schar);
-                    char *x = temp_alloc(sizeof(char));
-                    if (!x) return false;
-                    *x = l->string[0];
-                    da_append(values, x);
-                } else {
-                    fprintf(stderr, "ERROR: char literal must be single character\n");
-                    return false;
-                }
-                break;
-            }
+// Source text that defines name (for return types and signatures)
+static const char *compiler_source_for(Compiler_Context *ctx, const char *name) {
+    Delta_Unit *delta = delta_find(ctx, name);
+    return delta ? delta->source : ctx->source_code;
+}
 
-            case CLEX_charlit: {
-                // Direct character literal like 'a'
-                da_append(types, &ffi_type_schar);
-                char *x = temp_alloc(sizeof(char));
-                if (!x) return false;
-                *x = (char)l->int_number;  // Character value is in int_number
-                da_append(values, x);
-                break;
-            }
+typedef enum {
+    LIBRARY_NONE,
+    LIBRARY_SHARED,     // .so (also versioned, libfoo.so.1)
+    LIBRARY_ARCHIVE,    // .a
+    LIBRARY_OBJECT,     // .o
+} Library_Kind;
+
+static Library_Kind library_kind(const char *path) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    size_t len = strlen(base);
+    if (strstr(base, ".so.") || (len > 3 && strcmp(base + len - 3, ".so") == 0)) return LIBRARY_SHARED;
+    if (len > 2 && strcmp(base + len - 2, ".a") == 0) return LIBRARY_ARCHIVE;
+    if (len > 2 && strcmp(base + len - 2, ".o") == 0) return LIBRARY_OBJECT;
+    return LIBRARY_NONE;
+}
 
-            case CLEX_floatlit: {
-                // Check suffix for float (f or F)
-                const char *p = l->where_firstchar;
-                while (*p && (isdigit(*p) || *p == '.' || *p == 'e' ||
-                             *p == 'E' || *p == '+' || *p == '-')) {
-                    p++;
-                }
+// Attach a prebuilt artifact. Shared objects are loaded RTLD_GLOBAL right
+// away, so their exports are callable at once and TCC resolves references to
+// them; every artifact is also passed to tcc_add_file() by later compiles.
+// Returns the kind, or LIBRARY_NONE on failure.
+static Library_Kind library_load(const char *path) {
+    Library_Kind kind = library_kind(path);
+    if (kind == LIBRARY_NONE) {
+        fprintf(stderr, "ERROR: '%s' is not a .so, .a or .o file\n", path);
+        return LIBRARY_NONE;
+    }
 
-                if (*p == 'f' || *p == 'F') {
-                    da_append(types, &ffi_type_float);
-                    float *x = temp_alloc(sizeof(float));
-                    if (!x) return false;
-                    *x = (float)l->real_number;
-                    da_append(values, x);
-                } else {
-                    da_append(types, &ffi_type_double);
-                    double *x = temp_alloc(sizeof(double));
-                    if (!x) return false;
-                    *x = l->real_number;
-                    da_append(values, x);
-                }
-                break;
-            }
+    // dladdr() reports the path as given to dlopen(), so keep a canonical one
+    char resolved[PATH_MAX];
+    if (!realpath(path, resolved)) {
+        fprintf(stderr, "ERROR: Could not open '%s': %s\n", path, strerror(errno));
+        return LIBRARY_NONE;
+    }
+    for (size_t i = 0; i < loaded_libraries.count; i++) {
+        if (strcmp(loaded_libraries.items[i].path, resolved) == 0) {
+            fprintf(stderr, "ERROR: '%s' is already loaded\n", resolved);
+            return LIBRARY_NONE;
+        }
+    }
 
-            default:
-                fprintf(stderr, "ERROR: unsupported argument type (token: %ld)\n", l->token);
-                return false;
+    Loaded_Library lib = { .path = strdup(resolved) };
+    if (kind == LIBRARY_SHARED) {
+        lib.handle = dlopen(resolved, RTLD_NOW | RTLD_GLOBAL);
+        if (!lib.handle) {
+            fprintf(stderr, "ERROR: Could not load '%s': %s\n", resolved, dlerror());
+            free(lib.path);
+            return LIBRARY_NONE;
         }
     }
+    da_append(&loaded_libraries, lib);
+    call_cache_clear();
+    return kind;
+}
 
-    return true;
+static void library_drop_last(void) {
+    if (loaded_libraries.count == 0) return;
+    Loaded_Library *lib = &loaded_libraries.items[--loaded_libraries.count];
+    printf("Detached %s\n", lib->path);
+    if (lib->handle) dlclose(lib->handle);
+    free(lib->path);
+    call_cache_clear();
 }
 
+static void library_unload_all(void) {
+    for (size_t i = 0; i < loaded_libraries.count; i++) {
+        if (loaded_libraries.items[i].handle) dlclose(loaded_libraries.items[i].handle);
+        free(loaded_libraries.items[i].path);
+    }
+    da_free(&loaded_libraries);
+}
 
 // ============================================================================
-// Return Type Autodetection
+// Cached Compilation
 // ============================================================================
 
-// Function to find the start of return type
-const char* find_return_type_start(const char* code, const char* func_pos) {
-    const char* p = func_pos;
+static void hash_include_visitor(const char *path, const char *contents, void *ctx) {
+    uint64_t *hash = ctx;
+    *hash = fnv1a64_str(*hash, path);
+    *hash = fnv1a64_str(*hash, contents);
+}
 
-    // Move backwards to find the start of function declaration
-    while (p > code && *p != ';' && *p != '}' && *p != '{' && *p != '\n') {
-        p--;
-    }
+// Cache key: everything that can change the compiled output
+static uint64_t compiler_cache_key(const char *source_code, const char *source_path) {
+    uint64_t hash = FNV1A64_INIT;
 
-    // Skip the delimiter we found
-    if (p > code || *p == ';' || *p == '}' || *p == '{' || *p == '\n') {
-        p++;
+    hash = fnv1a64_str(hash, MALCREPL_TCC_VERSION);
+    hash = fnv1a64_str(hash, find_tcc_include_path());
+    for (int i = 0; system_include_paths[i] != NULL; i++) {
+        hash = fnv1a64_str(hash, system_include_paths[i]);
+    }
+    for (int i = 0; default_libraries[i] != NULL; i++) {
+        hash = fnv1a64_str(hash, default_libraries[i]);
+    }
+    // Loaded artifacts are linked in (.a/.o) or recorded as dependencies (.so)
+    for (size_t i = 0; i < loaded_libraries.count; i++) {
+        struct stat st;
+        hash = fnv1a64_str(hash, loaded_libraries.items[i].path);
+        if (stat(loaded_libraries.items[i].path, &st) == 0) {
+            hash = fnv1a64(hash, &st.st_mtime, sizeof(st.st_mtime));
+            hash = fnv1a64(hash, &st.st_size, sizeof(st.st_size));
+        }
     }
 
-    return p;
+    char dir[4096];
+    source_directory(source_path, dir, sizeof(dir));
+    hash = fnv1a64_str(hash, dir);
+    hash = fnv1a64_str(hash, source_code);
+
+    // Local headers are part of the translation unit too
+    visit_local_includes(source_code, dir, hash_include_visitor, &hash);
+
+    return hash;
 }
 
-bool extract_return_type(const char* code, const char* func_name, char* return_type, size_t return_type_size) {
-    if (!code || !func_name || !return_type || return_type_size == 0) {
-        return false;
+// Every load gets its own globals, as an in-memory compile would. dlopen()
+// of a path that is still loaded (reloading an unchanged source) returns
+// the old handle, so such an image is loaded from a private copy, which is
+// unlinked again once mapped.
+static Compiler_Context *compiler_load_image(const char *image_path, const char *source_path) {
+    char private_path[4096 + 16];
+    const char *load_path = image_path;
+    void *loaded = dlopen(image_path, RTLD_NOW | RTLD_LOCAL | RTLD_NOLOAD);
+    if (loaded) {
+        dlclose(loaded);
+        if (!cache_private_copy(image_path, private_path, sizeof(private_path))) {
+            compile_diag("WARNING: Could not copy cached image '%s'", image_path);
+            return NULL;
+        }
+        load_path = private_path;
     }
 
-    // Build search pattern: look for "function_name("
-    char pattern[256];
-    snprintf(pattern, sizeof(pattern), "%s(", func_name);
+    void *handle = dlopen(load_path, RTLD_NOW | RTLD_LOCAL);
+    if (load_path != image_path) unlink(load_path);
+    if (!handle) {
+        compile_diag("WARNING: Could not load cached image: %s", dlerror());
+        return NULL;
+    }
 
-    const char *func_decl = strstr(code, pattern);
-    if (!func_decl) {
-        return false;
+    Compiler_Context *ctx = calloc(1, sizeof(Compiler_Context));
+    if (!ctx) {
+        dlclose(handle);
+        return NULL;
     }
 
-    // Walk backwards to find start of return type
-    const char *p = func_decl - 1;
+    ctx->image_handle = handle;
+    ctx->image_path = strdup(load_path);  // What dladdr() reports for its symbols
+    ctx->image_private = load_path != image_path;
+    ctx->source_path = source_path ? strdup(source_path) : NULL;
+    return ctx;
+}
 
-    // Skip whitespace before function name
-    while (p > code && isspace((unsigned char)*p)) {
-        p--;
+// Load source_code from the image cache, compiling and storing it on a miss.
+// Returns NULL with *compile_failed = false when the cache can't be used
+// (caller falls back to in-memory compilation), or with *compile_failed = true
+// when the source itself does not compile.
+static Compiler_Context *compile_cached(const char *source_code, const char *source_path,
+                                        bool *compile_failed) {
+    *compile_failed = false;
+
+    uint64_t key = compiler_cache_key(source_code, source_path);
+    char image_path[4096];
+    if (!cache_entry_path(key, ".so", image_path, sizeof(image_path))) return NULL;
+
+    double start = now_ms();
+
+    if (access(image_path, R_OK) == 0) {
+        Compiler_Context *ctx = compiler_load_image(image_path, source_path);
+        if (ctx) {
+            double load_ms = now_ms() - start;
+            compile_stats.load_ms += load_ms;
+            compile_stats.kind = "cached image";
+            double compile_ms = cache_read_compile_ms(key);
+            double saved_ms = compile_ms > load_ms ? compile_ms - load_ms : 0.0;
+
+            cache_touch(key);
+            compile_cache.hits++;
+            compile_cache.saved_ms += saved_ms;
+            compile_cache.last_hit = true;
+            compile_cache.last_snapshot = false;
+            if (!diag_sink) {
+                printf("Loaded cached image in %.2f ms (saved %.2f ms)\n", load_ms, saved_ms);
+            }
+            return ctx;
+        }
+        // Unloadable entry (truncated, foreign arch, ...) - rebuild it below
     }
 
-    // Now p points to last char of return type
-    const char *ret_end = p + 1;
+    // Miss: compile to a shared object, publish it atomically, then load it
+    char tmp_path[4096 + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", image_path, (int)getpid());
 
-    // Walk backwards to find start of return type
-    // Stop at: newline, semicolon, closing brace, opening brace
-    while (p > code) {
-        char c = *p;
-        if (c == '\n' || c == ';' || c == '}' || c == '{') {
-            p++;
-            break;
-        }
-        p--;
+    pthread_mutex_lock(&tcc_lock);
+    Compiler_Context *builder = compiler_create();
+    if (!builder) {
+        pthread_mutex_unlock(&tcc_lock);
+        return NULL;
+    }
+    if (!compiler_build(builder, source_code, source_path, TCC_OUTPUT_DLL)) {
+        compiler_destroy(builder);
+        pthread_mutex_unlock(&tcc_lock);
+        compile_diag("ERROR: Compilation failed");
+        *compile_failed = true;
+        return NULL;
+    }
+    double output_start = now_ms();
+    bool written = tcc_output_file(builder->state, tmp_path) != -1;
+    compiler_destroy(builder);
+    pthread_mutex_unlock(&tcc_lock);
+    written = written && rename(tmp_path, image_path) == 0;
+    compile_stats.relocate_ms += now_ms() - output_start;
+    if (!written) {
+        compile_diag("WARNING: Could not write cached image '%s'", image_path);
+        unlink(tmp_path);
+        return NULL;
     }
 
-    // Skip leading whitespace
-    while (p < ret_end && isspace((unsigned char)*p)) {
-        p++;
+    double load_start = now_ms();
+    Compiler_Context *ctx = compiler_load_image(image_path, source_path);
+    compile_stats.load_ms += now_ms() - load_start;
+    if (!ctx) {
+        unlink(image_path);
+        return NULL;
     }
+    compile_stats.kind = "compiled, stored in cache";
 
-    // Calculate length
-    size_t len = ret_end - p;
+    cache_write_compile_ms(key, now_ms() - start);
+    cache_trim(key);
+    compile_cache.misses++;
+    compile_cache.last_hit = false;
+    return ctx;
+}
 
-    if (len == 0 || len >= return_type_size) {
-        return false;
-    }
+// ============================================================================
+// Multi-File Projects
+// ============================================================================
+//
+// Several sources (or every .c file of a directory) are compiled as separate
+// translation units and linked into one image. TCC 0.9.x keeps its compiler
+// state in globals, so units can't be compiled on threads of one process;
+// instead each unit gets a forked worker process with its own TCCState that
+// writes an object file, and the parent links the objects in a single state.
 
-    // Copy return type
-    memcpy(return_type, p, len);
-    return_type[len] = '\0';
+typedef struct {
+    char **items;
+    size_t count;
+    size_t capacity;
+} Path_Array;
 
-    // Trim trailing whitespace
-    while (len > 0 && isspace((unsigned char)return_type[len - 1])) {
-        return_type[--len] = '\0';
-    }
+// Translation units of the current project (empty for a single source)
+static Path_Array project_units = {0};
+static char *project_dir = NULL;    // Rescanned on reload when set
 
-    return len > 0;
+static void path_array_clear(Path_Array *paths) {
+    for (size_t i = 0; i < paths->count; i++) free(paths->items[i]);
+    paths->count = 0;
 }
 
-static ffi_type* detect_return_type(const char *function_name, const char *source_code) {
-    char return_type_str[64];
-    memset(return_type_str, 0, sizeof(return_type_str));
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
 
-    if (!extract_return_type(source_code, function_name, return_type_str, sizeof(return_type_str))) {
-        // Default to int if we can't detect
-        return &ffi_type_sint;
+// Collect every *.c file directly inside dir, sorted by name
+static bool project_scan_directory(const char *dir, Path_Array *units) {
+    DIR *d = opendir(dir);
+    if (!d) return false;
+
+    path_array_clear(units);
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 3 || strcmp(entry->d_name + len - 2, ".c") != 0) continue;
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        da_append(units, strdup(path));
     }
+    closedir(d);
 
-    // Trim whitespace
-    String_View rt = sv_trim(sv_from_cstr(return_type_str));
+    qsort(units->items, units->count, sizeof(char *), compare_paths);
+    return units->count > 0;
+}
 
-    // Check for void
-    if (rt.count == 4 && memcmp(rt.data, "void", 4) == 0) {
-        return &ffi_type_void;
+// Concatenated text of all units. Only used for scanning (return types,
+// :list, completion); every unit is still compiled on its own.
+static char *project_read_sources(const Path_Array *units) {
+    char *combined = NULL;
+    size_t size = 0;
+    double start = now_ms();
+
+    for (size_t i = 0; i < units->count; i++) {
+        char *text = read_entire_file(units->items[i]);
+        if (!text) {
+            free(combined);
+            return NULL;
+        }
+        size_t len = strlen(text);
+        char *grown = realloc(combined, size + len + 2);
+        if (!grown) {
+            free(text);
+            free(combined);
+            return NULL;
+        }
+        combined = grown;
+        memcpy(combined + size, text, len);
+        size += len;
+        combined[size++] = '\n';
+        combined[size] = '\0';
+        free(text);
     }
+    source_timings = (Source_Timings){ .fetch_ms = now_ms() - start };
+    return combined;
+}
 
-    // Check for pointer types (look for asterisk)
-    for (size_t i = 0; i < rt.count; i++) {
-        if (rt.data[i] == '*') {
-            return &ffi_type_pointer;
+// Set up project mode from the command line: a directory, or several files.
+// Returns false (single-source mode) for one plain file.
+static bool project_init(int count, char **paths) {
+    struct stat st;
+    if (count == 1) {
+        if (stat(paths[0], &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+        project_dir = strdup(paths[0]);
+        size_t len = strlen(project_dir);
+        while (len > 1 && project_dir[len - 1] == '/') project_dir[--len] = '\0';
+        if (!project_scan_directory(project_dir, &project_units)) {
+            fprintf(stderr, "ERROR: No .c files found in '%s'\n", project_dir);
+            exit(1);
         }
+        return true;
     }
 
-    // Check for char (single character, not pointer)
-    if (rt.count == 4 && memcmp(rt.data, "char", 4) == 0) {
-        return &ffi_type_schar;
+    for (int i = 0; i < count; i++) {
+        if (stat(paths[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+            fprintf(stderr, "ERROR: '%s' is not a source file\n", paths[i]);
+            exit(1);
+        }
+        da_append(&project_units, strdup(paths[i]));
     }
+    return true;
+}
 
-    // Check for int types
-    if ((rt.count == 3 && memcmp(rt.data, "int", 3) == 0) ||
-        (rt.count == 5 && memcmp(rt.data, "short", 5) == 0) ||
-        (rt.count >= 6 && memcmp(rt.data, "signed", 6) == 0) ||
-        (rt.count >= 8 && memcmp(rt.data, "unsigned", 8) == 0)) {
-        return &ffi_type_sint;
+static uint64_t project_cache_key(const Path_Array *units) {
+    uint64_t key = FNV1A64_INIT;
+    for (size_t i = 0; i < units->count; i++) {
+        char *text = read_entire_file(units->items[i]);
+        uint64_t unit_key = compiler_cache_key(text ? text : "", units->items[i]);
+        key = fnv1a64(key, &unit_key, sizeof(unit_key));
+        free(text);
     }
+    return key;
+}
 
-    // Check for long
-    if (rt.count == 4 && memcmp(rt.data, "long", 4) == 0) {
-        return &ffi_type_slong;
+// Worker process body: compile one unit to obj_path, diagnostics to log_path.
+// The forked child must not touch tcc_lock: it is still marked as owned by
+// the parent's thread, and the child has the only TCC state in its process.
+static void project_compile_unit(const char *unit_path, const char *obj_path,
+                                 const char *log_path) {
+    Error_Log errors = {0};
+    diag_sink = &errors;
+
+    char *text = read_entire_file(unit_path);
+    Compiler_Context *ctx = text ? compiler_create() : NULL;
+    bool ok = ctx && compiler_build(ctx, text, unit_path, TCC_OUTPUT_OBJ);
+    if (!ok) {
+        compile_diag("ERROR: Failed to compile '%s'", unit_path);
     }
+    ok = ok && tcc_output_file(ctx->state, obj_path) != -1;
 
-    // Check for float
-    if (rt.count == 5 && memcmp(rt.data, "float", 5) == 0) {
-        return &ffi_type_float;
+    FILE *log = fopen(log_path, "w");
+    if (log) {
+        error_log_flush(&errors, log);
+        fclose(log);
     }
+    _exit(ok ? 0 : 1);
+}
 
-    // Check for double
-    if (rt.count == 6 && memcmp(rt.data, "double", 6) == 0) {
-        return &ffi_type_double;
+static void project_collect_log(const char *log_path) {
+    char *log = read_entire_file(log_path);
+    if (log) {
+        size_t len = strlen(log);
+        while (len > 0 && log[len - 1] == '\n') log[--len] = '\0';
+        if (len > 0) compile_diag("%s", log);
+        free(log);
     }
-
-    // Default: assume int
-    return &ffi_type_sint;
+    unlink(log_path);
 }
 
-static void display_return_value(ffi_type *return_type, void *result) {
-    if (!result && return_type != &ffi_type_void) {
-        return;
+// Compile every unit to an object file in tmp_dir, using one worker process
+// per core. Returns true if all units compiled.
+static bool project_compile_objects(const Path_Array *units, const char *tmp_dir) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_workers = cores > 0 ? (size_t)cores : 1;
+
+    // Resolve the header snapshot once here rather than in every worker
+    header_snapshot_dir();
+
+    pid_t *pids = calloc(units->count, sizeof(pid_t));
+    if (!pids) return false;
+
+    bool ok = true;
+    size_t next = 0, running = 0, finished = 0;
+    fflush(stdout);
+    fflush(stderr);
+
+    while (finished < units->count) {
+        while (ok && next < units->count && running < max_workers) {
+            char obj_path[4096 + 32], log_path[4096 + 32];
+            snprintf(obj_path, sizeof(obj_path), "%s/%zu.o", tmp_dir, next);
+            snprintf(log_path, sizeof(log_path), "%s/%zu.log", tmp_dir, next);
+
+            // No TCC call may be in flight on another thread while forking
+            pthread_mutex_lock(&tcc_lock);
+            pid_t pid = fork();
+            if (pid == 0) {
+                project_compile_unit(units->items[next], obj_path, log_path);
+            }
+            pthread_mutex_unlock(&tcc_lock);
+            if (pid < 0) {
+                compile_diag("ERROR: Could not start compile worker");
+                ok = false;
+                break;
+            }
+            pids[next++] = pid;
+            running++;
+        }
+        if (running == 0) break;
+
+        // Reap only our own workers: wait() could take the exit status of a
+        // compiler the main thread is waiting for (see run_process_input()).
+        // Any finished worker first, otherwise block on the oldest one.
+        int status;
+        size_t reaped = next;
+        for (size_t i = 0; i < next && reaped == next; i++) {
+            if (pids[i] > 0 && waitpid(pids[i], &status, WNOHANG) == pids[i]) reaped = i;
+        }
+        for (size_t i = 0; i < next && reaped == next; i++) {
+            if (pids[i] <= 0) continue;
+            pid_t pid;
+            do {
+                pid = waitpid(pids[i], &status, 0);
+            } while (pid < 0 && errno == EINTR);
+            if (pid < 0) {
+                ok = false;
+                pids[i] = 0;
+                running--;
+                finished++;
+                break;
+            }
+            reaped = i;
+        }
+        if (reaped == next) continue;
+
+        char log_path[4096 + 32];
+        snprintf(log_path, sizeof(log_path), "%s/%zu.log", tmp_dir, reaped);
+        project_collect_log(log_path);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+        pids[reaped] = 0;
+        running--;
+        finished++;
     }
 
-    // Match by type size and alignment as backup
-    int is_char = (return_type == &ffi_type_schar) ||
-                  (return_type == &ffi_type_sint8) ||
-                  (return_type == &ffi_type_uint8) ||
-                  (return_type->size == 1 && return_type->alignment == 1);
+    free(pids);
+    return ok && finished == units->count;
+}
 
-    int is_int = (return_type == &ffi_type_sint) ||
-                 (return_type == &ffi_type_sint32) ||
-                 (return_type == &ffi_type_uint32);
+static void project_remove_temp(const char *tmp_dir, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        char path[4096 + 32];
+        snprintf(path, sizeof(path), "%s/%zu.o", tmp_dir, i);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%zu.log", tmp_dir, i);
+        unlink(path);
+    }
+    rmdir(tmp_dir);
+}
 
-    int is_long = (return_type == &ffi_type_slong) ||
-                  (return_type == &ffi_type_sint64);
+// Link the unit objects in tmp_dir into ctx (configured for output_type)
+static bool project_link_objects(Compiler_Context *ctx, const Path_Array *units,
+                                 const char *tmp_dir, int output_type) {
+    if (!compiler_configure(ctx, units->items[0], output_type, NULL)) return false;
 
-    if (return_type == &ffi_type_void) {
-        // Don't print anything for void
-    } else if (is_char) {
-        char c = *(char*)result;
-        if (isprint((unsigned char)c)) {
-            printf("→ '%c' (%d)\n", c, (int)c);
-        } else {
-            printf("→ %d (non-printable)\n", (int)c);
-        }
-    } else if (is_int) {
-        printf("→ %d\n", *(int*)result);
-    } else if (is_long) {
-        printf("→ %ld\n", *(long*)result);
-    } else if (return_type == &ffi_type_float) {
-        printf("→ %f\n", *(float*)result);
-    } else if (return_type == &ffi_type_double) {
-        printf("→ %lf\n", *(double*)result);
-    } else if (return_type == &ffi_type_pointer) {
-        void *ptr = *(void**)result;
+    for (size_t i = 0; i < units->count; i++) {
+        char obj_path[4096 + 32];
+        snprintf(obj_path, sizeof(obj_path), "%s/%zu.o", tmp_dir, i);
+        if (tcc_add_file(ctx->state, obj_path) == -1) return false;
+    }
+    return true;
+}
 
-        if (!ptr) {
-            printf("→ NULL\n");
-        } else {
-            // Try to display as string
-            const char *str = (const char*)ptr;
-            size_t len = 0;
+static Compiler_Context *compile_project(const Path_Array *units, bool use_cache) {
+    double start = now_ms();
+    char image_path[4096];
+    uint64_t key = use_cache ? project_cache_key(units) : 0;
+    use_cache = use_cache && cache_entry_path(key, ".so", image_path, sizeof(image_path));
+
+    if (use_cache && access(image_path, R_OK) == 0) {
+        Compiler_Context *ctx = compiler_load_image(image_path, units->items[0]);
+        if (ctx) {
+            double load_ms = now_ms() - start;
+            compile_stats.load_ms += load_ms;
+            compile_stats.kind = "cached project image";
+            double compile_ms = cache_read_compile_ms(key);
+            double saved_ms = compile_ms > load_ms ? compile_ms - load_ms : 0.0;
+            cache_touch(key);
+            compile_cache.hits++;
+            compile_cache.saved_ms += saved_ms;
+            compile_cache.last_hit = true;
+            compile_cache.last_snapshot = false;
+            return ctx;
+        }
+    }
 
-            // Check if it looks like a string
-            while (len < 256 && str[len]) {
-                if (!isprint((unsigned char)str[len]) && !isspace((unsigned char)str[len])) {
-                    // Not a string
-                    printf("→ %p\n", ptr);
-                    return;
-                }
-                len++;
-            }
+    char tmp_dir[] = "/tmp/malcrepl-XXXXXX";
+    if (!mkdtemp(tmp_dir)) {
+        compile_diag("ERROR: Could not create temporary directory");
+        return NULL;
+    }
 
-            if (len > 0 && len < 256) {
-                printf("→ \"%s\"\n", str);
-            } else {
-                printf("→ %p\n", ptr);
-            }
+    if (!project_compile_objects(units, tmp_dir)) {
+        project_remove_temp(tmp_dir, units->count);
+        compile_diag("ERROR: Compilation failed");
+        return NULL;
+    }
+    double objects_ms = now_ms() - start;
+    compile_stats.compile_ms += objects_ms;  // Wall time of the parallel workers
+    compile_stats.kind = "project, units compiled in parallel";
+
+    pthread_mutex_lock(&tcc_lock);
+    Compiler_Context *ctx = compiler_create();
+    bool ok = ctx != NULL;
+    if (ok && use_cache) {
+        // Link straight into a cached image
+        char tmp_path[4096 + 32];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", image_path, (int)getpid());
+        ok = project_link_objects(ctx, units, tmp_dir, TCC_OUTPUT_DLL) &&
+             tcc_output_file(ctx->state, tmp_path) != -1;
+        compiler_destroy(ctx);
+        pthread_mutex_unlock(&tcc_lock);
+        ok = ok && rename(tmp_path, image_path) == 0;
+        ctx = ok ? compiler_load_image(image_path, units->items[0]) : NULL;
+        if (!ok) unlink(tmp_path);
+        if (ctx) {
+            cache_write_compile_ms(key, now_ms() - start);
+            cache_trim(key);
+            compile_cache.misses++;
+        } else {
+            compile_diag("ERROR: Linking failed - check for undefined or duplicate symbols");
+        }
+    } else if (ok) {
+        ok = project_link_objects(ctx, units, tmp_dir, TCC_OUTPUT_MEMORY) &&
+             tcc_relocate(ctx->state, TCC_RELOCATE_AUTO) >= 0;
+        if (!ok) {
+            compile_diag("ERROR: Linking failed - check for undefined or duplicate symbols");
+            compiler_destroy(ctx);
+            ctx = NULL;
+        } else {
+            free(ctx->source_path);
+            ctx->source_path = strdup(units->items[0]);
         }
+        pthread_mutex_unlock(&tcc_lock);
     } else {
-        printf("→ [unknown type, size=%zu]\n", return_type->size);
+        pthread_mutex_unlock(&tcc_lock);
+    }
+    project_remove_temp(tmp_dir, units->count);
+    compile_stats.relocate_ms += now_ms() - start - objects_ms;
+
+    if (ctx && !diag_sink) {
+        printf("Compiled %zu units in %.2f ms (objects %.2f ms, link %.2f ms)\n",
+               units->count, now_ms() - start, objects_ms, now_ms() - start - objects_ms);
+    }
+    compile_cache.last_hit = false;
+    return ctx;
+}
+
+// Compile source_code into a new context, or return NULL. Never exits, so it
+// is safe for background reloads; source_code stays owned by the caller.
+// In project mode the units are compiled from disk and source_code is only
+// their combined text.
+static Compiler_Context *compile_source(const char *source_code, const char *source_path,
+                                        bool use_cache) {
+    double start = now_ms();
+    Compiler_Context *compiler = NULL;
+    compile_stats = (Compile_Stats){ .kind = "in-memory" };
+    compile_cache = (Cache_Stats){0};
+    // A cached image resolves malloc through the dynamic linker, out of reach
+    // of tcc_add_symbol()
+    use_cache = use_cache && !alloc_hooks;
+
+    if (project_units.count > 0) {
+        compiler = compile_project(&project_units, use_cache);
+        goto done;
+    }
+
+    // Any snapshot build happens here, before TCC is locked
+    if (source_wants_snapshot(source_code)) {
+        double snapshot_start = now_ms();
+        header_snapshot_dir();
+        compile_stats.snapshot_ms += now_ms() - snapshot_start;
+    }
+
+    if (use_cache) {
+        bool compile_failed = false;
+        compiler = compile_cached(source_code, source_path, &compile_failed);
+        if (compiler || compile_failed) goto done;
+    }
+
+    pthread_mutex_lock(&tcc_lock);
+    compiler = compiler_create();
+    if (!compiler) {
+        pthread_mutex_unlock(&tcc_lock);
+        compile_diag("ERROR: Could not create compiler context");
+        goto done;
+    }
+
+    // Configure and compile source
+    if (!compiler_compile_string(compiler, source_code, source_path)) {
+        compiler_destroy(compiler);
+        compiler = NULL;
+    }
+    pthread_mutex_unlock(&tcc_lock);
+    if (!compiler) goto done;
+    compile_cache.last_hit = false;
+
+done:
+    if (compiler) {
+        compile_cache.last_ms = now_ms() - start;
+        // The source was fetched on this thread just before compiling
+        compile_stats.fetch_ms = source_timings.fetch_ms;
+        compile_stats.decrypt_ms = source_timings.decrypt_ms;
+        compile_stats.total_ms = compile_cache.last_ms + source_timings.fetch_ms +
+                                 source_timings.decrypt_ms;
+        compiler->stats = compile_stats;
+        compiler->cache = compile_cache;
+    }
+    source_timings = (Source_Timings){0};
+    return compiler;
+}
+
+Compiler_Context* compile(char* source_code, char *source_path, bool use_cache){
+    Compiler_Context *compiler = compile_source(source_code, source_path, use_cache);
+    if (!compiler) {
+        fprintf(stderr, "ERROR: Failed to compile '%s'\n", source_path);
+        free(source_code);
+        exit(1);
     }
+    return compiler;
 }
 
 // ============================================================================
-// Function Listing
+// Direct-Call Stubs
 // ============================================================================
+//
+// ffi_call() re-interprets the cif on every call. For each signature the
+// prompt uses, a small typed trampoline is generated and compiled with TCC
+// instead: it unpacks the argument buffer and calls the target through a
+// correctly typed function pointer. Stubs depend only on the signature, so
+// they are shared by every function with it and survive reloads. Signatures
+// with types the generator doesn't know, or a stub that fails to compile,
+// keep using ffi_call().
+
+#define STUB_MAX_ARGS 16
 
 typedef struct {
-    char *name;
-    char *signature;
-} Function_Info;
+    ffi_type *return_type;
+    ffi_type *arg_types[STUB_MAX_ARGS];
+    unsigned arg_count;
+    TCCState *state;
+    Call_Stub fn;               // NULL when the signature falls back to ffi_call()
+} Stub_Entry;
 
 typedef struct {
-    Function_Info *items;
+    Stub_Entry *items;
     size_t count;
     size_t capacity;
-} Function_Array;
+} Stub_Cache;
+
+static Stub_Cache stub_cache = {0};
+
+// C spelling of the types the argument parsers and detect_return_type() produce
+// (ffi_type_sint, _slong and _schar are aliases of the fixed-width types)
+static const char *stub_c_type(ffi_type *type) {
+    if (type == &ffi_type_void) return "void";
+    if (type == &ffi_type_sint32) return "int";
+    if (type == &ffi_type_uint32) return "unsigned int";
+    if (type == &ffi_type_sint64) return "long long";
+    if (type == &ffi_type_uint64) return "unsigned long long";
+    if (type == &ffi_type_sint16) return "short";
+    if (type == &ffi_type_uint16) return "unsigned short";
+    if (type == &ffi_type_sint8) return "signed char";
+    if (type == &ffi_type_uint8) return "unsigned char";
+    if (type == &ffi_type_float) return "float";
+    if (type == &ffi_type_double) return "double";
+    if (type == &ffi_type_pointer) return "void *";
+    return NULL;
+}
 
-// Extract function signature from source code
-static bool extract_function_signature(const char *source_code, const char *func_name, 
-                                       char *signature, size_t sig_size) {
-    if (!source_code || !func_name || !signature || sig_size == 0) {
-        return false;
-    }
-    
-    // Build search pattern
-    char pattern[256];
-    snprintf(pattern, sizeof(pattern), "%s(", func_name);
-    
-    const char *func_decl = strstr(source_code, pattern);
-    if (!func_decl) {
-        return false;
-    }
-    
-    // Find start of signature (walk back to find return type)
-    const char *sig_start = func_decl;
-    while (sig_start > source_code && 
-           *sig_start != '\n' && *sig_start != ';' && 
-           *sig_start != '}' && *sig_start != '{') {
-        sig_start--;
-    }
-    if (*sig_start == '\n' || *sig_start == ';' || *sig_start == '}' || *sig_start == '{') {
-        sig_start++;
+// Never waits for TCC: while a background compile holds tcc_lock, *busy is
+// set and the call goes through ffi_call() until a later attempt succeeds.
+static Call_Stub stub_build(Stub_Entry *entry, bool *busy) {
+    char source[4096];
+    size_t used = 0;
+    const char *rtype = stub_c_type(entry->return_type);
+
+    // void malcrepl_stub(void *f, void **a, void *r) { *(R *)r = ((R (*)(A0, ...))f)(*(A0 *)a[0], ...); }
+    used += snprintf(source + used, sizeof(source) - used,
+                     "void malcrepl_stub(void *f, void **a, void *r) {\n    ");
+    if (entry->return_type != &ffi_type_void) {
+        used += snprintf(source + used, sizeof(source) - used, "*(%s *)r = ", rtype);
     }
-    
-    // Skip leading whitespace
-    while (*sig_start && isspace((unsigned char)*sig_start)) {
-        sig_start++;
+    used += snprintf(source + used, sizeof(source) - used, "((%s (*)(", rtype);
+    for (unsigned i = 0; i < entry->arg_count; i++) {
+        used += snprintf(source + used, sizeof(source) - used, "%s%s",
+                         i ? ", " : "", stub_c_type(entry->arg_types[i]));
     }
-    
-    // Find end of signature (closing paren)
-    const char *sig_end = func_decl + strlen(func_name) + 1; // After "func_name("
-    int paren_depth = 1;
-    while (*sig_end && paren_depth > 0) {
-        if (*sig_end == '(') paren_depth++;
-        if (*sig_end == ')') paren_depth--;
-        sig_end++;
+    used += snprintf(source + used, sizeof(source) - used, "%s))f)(",
+                     entry->arg_count ? "" : "void");
+    for (unsigned i = 0; i < entry->arg_count; i++) {
+        used += snprintf(source + used, sizeof(source) - used, "%s*(%s *)a[%u]",
+                         i ? ", " : "", stub_c_type(entry->arg_types[i]), i);
     }
-    
-    // Calculate length and copy
-    size_t len = sig_end - sig_start;
-    if (len >= sig_size) {
-        len = sig_size - 1;
+    snprintf(source + used, sizeof(source) - used, ");\n}\n");
+
+    if (pthread_mutex_trylock(&tcc_lock) != 0) {
+        *busy = true;
+        return NULL;
     }
-    
-    memcpy(signature, sig_start, len);
-    signature[len] = '\0';
-    
-    // Clean up extra whitespace
-    char *dst = signature;
-    const char *src = signature;
-    int last_was_space = 0;
-    
-    while (*src) {
-        if (isspace((unsigned char)*src)) {
-            if (!last_was_space && dst != signature) {
-                *dst++ = ' ';
-            }
-            last_was_space = 1;
+    Call_Stub fn = NULL;
+    TCCState *state = tcc_new_state();
+    if (state) {
+        tcc_set_output_type(state, TCC_OUTPUT_MEMORY);
+        if (tcc_compile_string(state, source) == 0 &&
+            tcc_relocate(state, TCC_RELOCATE_AUTO) >= 0) {
+            fn = (Call_Stub)tcc_get_symbol(state, "malcrepl_stub");
+        }
+        if (fn) {
+            entry->state = state;
         } else {
-            *dst++ = *src;
-            last_was_space = 0;
+            tcc_delete(state);
         }
-        src++;
     }
-    *dst = '\0';
-    
-    return true;
+    pthread_mutex_unlock(&tcc_lock);
+
+    if (fn && jit_export_enabled()) {
+        char name[1024];
+        size_t n = (size_t)snprintf(name, sizeof(name), "malcrepl_stub[%s(", rtype);
+        for (unsigned i = 0; i < entry->arg_count && n < sizeof(name); i++) {
+            n += (size_t)snprintf(name + n, sizeof(name) - n, "%s%s",
+                                  i ? ", " : "", stub_c_type(entry->arg_types[i]));
+        }
+        if (n < sizeof(name)) snprintf(name + n, sizeof(name) - n, ")]");
+        jit_export_code((void *)fn, tcc_code_size((void *)fn, 0), name);
+    }
+    return fn;
 }
 
-// List all functions in the compiled source
-static void list_functions(Compiler_Context *compiler) {
-    if (!compiler || !compiler->source_code) {
-        printf("ERROR: No compiled source available\n");
-        return;
+// Stub for a signature, generating it on first use. NULL means ffi_call();
+// *busy tells the caller to ask again later (see stub_build()).
+static Call_Stub stub_for(ffi_type *return_type, ffi_type **types, size_t count, bool *busy) {
+    *busy = false;
+    if (count > STUB_MAX_ARGS || !stub_c_type(return_type)) return NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (!stub_c_type(types[i]) || types[i] == &ffi_type_void) return NULL;
     }
-    
-    Function_Array functions = {0};
-    
-    // Parse source code to find function definitions
-    const char *p = compiler->source_code;
-    char current_func[256];
-    
-    while (*p) {
-        // Skip whitespace and comments
-        while (*p && isspace((unsigned char)*p)) p++;
-        
-        // Look for function patterns (simplified - looks for identifier followed by '(')
-        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || *p == '_') {
-            const char *word_start = p;
-            
-            // Read identifier
-            while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || 
-                   (*p >= '0' && *p <= '9') || *p == '_') {
-                p++;
-            }
-            
-            // Skip whitespace
-            while (*p && isspace((unsigned char)*p)) p++;
-            
-            // Check if this is a function (followed by '(')
-            if (*p == '(') {
-                size_t name_len = p - word_start;
-                while (word_start < p && isspace((unsigned char)*(p-1))) {
-                    p--;
-                    name_len--;
-                }
-                
-                if (name_len > 0 && name_len < sizeof(current_func)) {
-                    memcpy(current_func, word_start, name_len);
-                    current_func[name_len] = '\0';
-                    
-                    // Check if it's actually callable (not a keyword, has a body)
-                    void *func_ptr = compiler_get_symbol(compiler, current_func);
-                    if (func_ptr) {
-                        // Extract full signature
-                        char signature[512];
-                        if (extract_function_signature(compiler->source_code, current_func, 
-                                                      signature, sizeof(signature))) {
-                            // Add to list
-                            if (functions.count >= functions.capacity) {
-                                size_t new_cap = functions.capacity == 0 ? 16 : functions.capacity * 2;
-                                Function_Info *new_items = realloc(functions.items, 
-                                                                   new_cap * sizeof(Function_Info));
-                                if (!new_items) {
-                                    fprintf(stderr, "ERROR: Out of memory\n");
-                                    da_free(&functions);
-                                    return;
-                                }
-                                functions.items = new_items;
-                                functions.capacity = new_cap;
-                            }
-                            
-                            functions.items[functions.count].name = strdup(current_func);
-                            functions.items[functions.count].signature = strdup(signature);
-                            functions.count++;
-                        }
-                    }
-                }
-            }
-        } else {
-            p++;
+
+    for (size_t i = 0; i < stub_cache.count; i++) {
+        Stub_Entry *entry = &stub_cache.items[i];
+        if (entry->return_type == return_type && entry->arg_count == count &&
+            memcmp(entry->arg_types, types, count * sizeof(*types)) == 0) {
+            return entry->fn;
         }
     }
-    
-    // Display functions
-    if (functions.count == 0) {
-        printf("\nNo callable functions found.\n\n");
-    } else {
-        printf("\n╔════════════════════════════════════════════════════════════╗\n");
-        printf("║  Available Functions (%zu)%*s║\n", functions.count, 
-               (int)(37 - snprintf(NULL, 0, "%zu", functions.count)), "");
-        printf("╠════════════════════════════════════════════════════════════╣\n");
-        
-        for (size_t i = 0; i < functions.count; i++) {
-            printf("  %s\n", functions.items[i].signature);
-        }
-        
-        printf("╚════════════════════════════════════════════════════════════╝\n\n");
+
+    Stub_Entry entry = { .return_type = return_type, .arg_count = (unsigned)count };
+    if (count) memcpy(entry.arg_types, types, count * sizeof(*types));
+    entry.fn = stub_build(&entry, busy);
+    if (*busy) return NULL;
+    da_append(&stub_cache, entry);
+    return entry.fn;
+}
+
+static size_t stub_count(void) {
+    size_t count = 0;
+    for (size_t i = 0; i < stub_cache.count; i++) {
+        if (stub_cache.items[i].fn) count++;
     }
-    
-    // Cleanup
-    for (size_t i = 0; i < functions.count; i++) {
-        free(functions.items[i].name);
-        free(functions.items[i].signature);
+    return count;
+}
+
+static void stub_cache_free(void) {
+    pthread_mutex_lock(&tcc_lock);
+    for (size_t i = 0; i < stub_cache.count; i++) {
+        if (stub_cache.items[i].state) tcc_delete(stub_cache.items[i].state);
     }
-    da_free(&functions);
+    pthread_mutex_unlock(&tcc_lock);
+    da_free(&stub_cache);
 }
 
 // ============================================================================
-// REPL Commands
+// Top-Level Declarations
 // ============================================================================
+//
+// Token-level scan of file-scope declarations, enough to tell which names a
+// source defines (functions with a body, variables without extern) and which
+// it only declares. Function bodies, struct members, initializers and
+// preprocessor lines are skipped, so names used inside them are not reported.
+
+typedef enum {
+    TOP_FUNCTION_DEF,
+    TOP_FUNCTION_DECL,
+    TOP_VARIABLE_DEF,
+    TOP_VARIABLE_DECL,
+} Top_Level_Kind;
+
+// where points at the name inside the scanned source
+typedef void (*Top_Level_Visitor)(const char *name, Top_Level_Kind kind,
+                                  const char *where, void *ctx);
+
+static bool is_declaration_keyword(const char *id) {
+    static const char *keywords[] = {
+        "void", "char", "short", "int", "long", "float", "double", "signed",
+        "unsigned", "_Bool", "struct", "union", "enum", "const", "volatile",
+        "restrict", "static", "inline", "register", "auto", "_Noreturn",
+        "__attribute__", "__asm__", "asm", NULL
+    };
+    for (int i = 0; keywords[i] != NULL; i++) {
+        if (strcmp(id, keywords[i]) == 0) return true;
+    }
+    return false;
+}
 
-static void print_help(void) {
-    printf("\nBuiltin commands:\n"
-           "  :help, :h   - Show this help message\n"
-           "  :quit, :q   - Exit the REPL\n"
-           "  :info       - Show compilation info\n"
-           "  :list, :l   - List all available functions\n"
-           "  :reload, :r - Reload and recompile source file\n"
-           "\nFunction call format:\n"
-           "  function_name [args...]\n"
-           "\nSupported argument types:\n"
-           "  - Integers: 42, -10, 100L (long)\n"
-           "  - Floats: 3.14, 2.5f (float), 1.0 (double)\n"
-           "  - Strings: \"hello world\"\n"
-           "  - Characters: 'a', 'Z'\n\n");
+// Skip a balanced (...) / [...] / {...} group whose opener was just read
+static void lexer_skip_group(stb_lexer *l, long open, long close) {
+    int depth = 1;
+    while (depth > 0 && stb_c_lexer_get_token(l)) {
+        if (l->token == open) depth++;
+        else if (l->token == close) depth--;
+    }
+}
+
+static void scan_top_level(const char *source, Top_Level_Visitor fn, void *ctx) {
+    if (!source) return;
+
+    stb_lexer l;
+    char store[4096];
+    stb_c_lexer_init(&l, source, source + strlen(source), store, sizeof(store));
+
+    char name[256] = "";            // Last declarator name at file scope
+    const char *name_at = NULL;
+    bool is_extern = false, is_typedef = false;
+    long prev = 0;                  // Previous file-scope token
+    bool reuse = false;             // l.token was read ahead and still needs handling
+
+    while (reuse || stb_c_lexer_get_token(&l)) {
+        reuse = false;
+        long tok = l.token;
+
+        if (tok == CLEX_id) {
+            if (strcmp(l.string, "extern") == 0) {
+                is_extern = true;
+            } else if (strcmp(l.string, "typedef") == 0) {
+                is_typedef = true;
+            } else if (!is_declaration_keyword(l.string)) {
+                snprintf(name, sizeof(name), "%s", l.string);
+                name_at = l.where_firstchar;
+            }
+        } else if (tok == '(' && prev == CLEX_id && name[0]) {
+            // Parameter list: a body makes it a definition
+            lexer_skip_group(&l, '(', ')');
+            bool has_next = stb_c_lexer_get_token(&l);
+            bool body = has_next && l.token == '{';
+            if (!is_typedef) {
+                fn(name, body ? TOP_FUNCTION_DEF : TOP_FUNCTION_DECL, name_at, ctx);
+            }
+            name[0] = '\0';
+            if (body) {
+                lexer_skip_group(&l, '{', '}');
+                is_extern = is_typedef = false;
+                prev = '}';
+                continue;
+            }
+            reuse = has_next;
+            prev = ')';
+            continue;
+        } else if (tok == '(') {
+            lexer_skip_group(&l, '(', ')');  // Declarator such as (*fp)
+            tok = ')';
+        } else if ((tok == '=' || tok == ';' || tok == ',' || tok == '[') &&
+                   prev == CLEX_id && name[0]) {
+            if (!is_typedef) {
+                fn(name, is_extern ? TOP_VARIABLE_DECL : TOP_VARIABLE_DEF, name_at, ctx);
+            }
+            name[0] = '\0';
+        }
+
+        if (tok == '[') {
+            lexer_skip_group(&l, '[', ']');
+            tok = ']';
+        } else if (tok == '{') {
+            lexer_skip_group(&l, '{', '}');  // struct/union/enum body
+            tok = '}';
+        } else if (tok == '=') {
+            // Initializer, up to the next declarator or the end of the declaration
+            int depth = 0;
+            while (stb_c_lexer_get_token(&l)) {
+                if (l.token == '(' || l.token == '[' || l.token == '{') depth++;
+                else if (l.token == ')' || l.token == ']' || l.token == '}') depth--;
+                else if (depth == 0 && (l.token == ',' || l.token == ';')) {
+                    reuse = true;
+                    break;
+                }
+            }
+        } else if (tok == ';') {
+            is_extern = is_typedef = false;
+            name[0] = '\0';
+        }
+        prev = tok;
+    }
 }
 
 // ============================================================================
-// Readline History Support
+// Optimizing Tier
 // ============================================================================
+//
+// TCC compiles fast but barely optimizes. Functions that get hot (or are
+// named with :optimize) are served from a second image built by the system
+// C compiler at -O2 -march=native. The whole source is rebuilt, so the
+// promoted function keeps its callees, and the result is dlopen()ed next to
+// the TCC image. Each image would have its own copy of the source's
+// globals, so a source with mutable global or static variables is never
+// promoted: its state would silently restart in the optimized code.
+
+#define TIER_CALL_THRESHOLD 1000        // Auto-promote after this many calls...
+#define TIER_TIME_THRESHOLD_MS 100.0    // ...or this much time spent in the function
+
+static bool tier_auto = false;          // :tier on
+
+// The optimizing compiler: $MALCREPL_CC, else cc
+static const char *tier_compiler(void) {
+    const char *cc = getenv("MALCREPL_CC");
+    return cc && cc[0] ? cc : "cc";
+}
 
-#ifdef HAVE_READLINE
-
-// History file location
-static char history_file_path[512];
+// A declaration declares a const object when `const` follows its last '*',
+// or appears anywhere when it has none. text runs from the start of the
+// declaration to the declarator's name.
+static bool declaration_is_const(const char *text, const char *name_at) {
+    bool is_const = false;
+    for (const char *p = text; p < name_at; p++) {
+        if (*p == '*') {
+            is_const = false;
+        } else if (strncmp(p, "const", 5) == 0 && p + 5 <= name_at &&
+                   (p == text || !(isalnum((unsigned char)p[-1]) || p[-1] == '_')) &&
+                   !(isalnum((unsigned char)p[5]) || p[5] == '_')) {
+            is_const = true;
+            p += 4;
+        }
+    }
+    return is_const;
+}
 
-// Global pointer to compiler context for completion
-static Compiler_Context *g_compiler_for_completion = NULL;
+typedef struct {
+    const char *source;
+    char *name;             // First mutable variable found
+    size_t size;
+    bool found;
+} Tier_State_Scan;
+
+static void tier_state_visitor(const char *name, Top_Level_Kind kind, const char *where, void *ctx) {
+    Tier_State_Scan *scan = ctx;
+    if (scan->found || kind != TOP_VARIABLE_DEF) return;
+
+    // The declaration starts after the previous ';' or '}'
+    const char *start = where;
+    while (start > scan->source && start[-1] != ';' && start[-1] != '}') start--;
+    if (declaration_is_const(start, where)) return;
+    snprintf(scan->name, scan->size, "%s", name);
+    scan->found = true;
+}
 
-// Initialize readline and history
-static void init_readline_history(void) {
-    const char *home = getenv("HOME");
-    if (home) {
-        snprintf(history_file_path, sizeof(history_file_path), 
-                "%s/.malcrepl_history", home);
-        read_history(history_file_path);
-        stifle_history(1000);
+// Find a variable the optimized image would duplicate: a non-const global
+// or a static local. Errs on the side of reporting one.
+static bool source_find_mutable_state(const char *source, char *name, size_t size) {
+    Tier_State_Scan scan = { .source = source, .name = name, .size = size };
+    scan_top_level(source, tier_state_visitor, &scan);
+    if (scan.found || !source) return scan.found;
+
+    stb_lexer l;
+    char store[4096];
+    stb_c_lexer_init(&l, source, source + strlen(source), store, sizeof(store));
+    int depth = 0;
+    while (stb_c_lexer_get_token(&l)) {
+        if (l.token == '{') depth++;
+        else if (l.token == '}') depth--;
+        if (depth <= 0 || l.token != CLEX_id || strcmp(l.string, "static") != 0) continue;
+
+        // Static local: its name is the last identifier before the declarator ends
+        const char *start = l.where_firstchar;
+        const char *name_at = NULL;
+        while (stb_c_lexer_get_token(&l)) {
+            if (l.token == '{') {
+                lexer_skip_group(&l, '{', '}');
+            } else if (l.token == CLEX_id && !is_declaration_keyword(l.string)) {
+                snprintf(name, size, "%s", l.string);
+                name_at = l.where_firstchar;
+            } else if (l.token == '=' || l.token == ';' || l.token == ',' ||
+                       l.token == '[' || l.token == '(') {
+                break;
+            }
+        }
+        if (l.token == '(') lexer_skip_group(&l, '(', ')');
+        if (name_at && !declaration_is_const(start, name_at)) return true;
     }
+    return false;
 }
 
-// Save history on exit
-static void save_readline_history(void) {
-    if (history_file_path[0] != '\0') {
-        write_history(history_file_path);
+static Tier_Entry *tier_lookup(Compiler_Context *ctx, const char *name) {
+    for (size_t i = 0; i < ctx->tier.count; i++) {
+        if (strcmp(ctx->tier.items[i].name, name) == 0) return &ctx->tier.items[i];
     }
+    Tier_Entry entry = { .name = strdup(name) };
+    da_append(&ctx->tier, entry);
+    return &ctx->tier.items[ctx->tier.count - 1];
 }
 
-// Custom completion generator for REPL commands
-static char *command_generator(const char *text, int state) {
-    static const char *commands[] = {
-        ":help", ":h", ":quit", ":q", ":info", 
-        ":list", ":l", ":reload", ":r", NULL
-    };
-    static int list_index;
-    static size_t len;
-    
-    if (!state) {
-        list_index = 0;
-        len = strlen(text);
+// Build the optimized image for ctx. The source goes to the compiler on
+// stdin, so decrypted code is never written out; the shared object lives in
+// a private temporary directory only until it is loaded. Also runs on the
+// reload thread, so messages go through source_message().
+static bool tier_build(Compiler_Context *ctx) {
+    if (ctx->tier_handle) return true;
+    if (ctx->tier_failed) return false;
+    ctx->tier_failed = true;    // Until proven otherwise
+
+    bool project = project_units.count > 0;
+    if (!project && !ctx->source_code) return false;
+
+    char state[256];
+    if (source_find_mutable_state(ctx->source_code, state, sizeof(state))) {
+        source_message(stdout, "No optimized image: it would get its own copy of '%s', "
+                       "so state kept in it would restart", state);
+        return false;
+    }
+
+    char tmp_dir[] = "/tmp/malcrepl-XXXXXX";
+    if (!mkdtemp(tmp_dir)) {
+        fprintf(stderr, "ERROR: Could not create temporary directory\n");
+        return false;
+    }
+    char so_path[64];
+    snprintf(so_path, sizeof(so_path), "%s/tier.so", tmp_dir);
+
+    char include_arg[4096 + 2] = "";
+    const char *first = project ? project_units.items[0] : ctx->source_path;
+    if (first && !is_url(first)) {
+        char dir[4096];
+        source_directory(first, dir, sizeof(dir));
+        snprintf(include_arg, sizeof(include_arg), "-I%s", dir[0] ? dir : ".");
+    }
+
+    char **argv = calloc(project_units.count + loaded_libraries.count + 17, sizeof(char *));
+    if (!argv) {
+        rmdir(tmp_dir);
+        return false;
+    }
+    int argc = 0;
+    argv[argc++] = (char *)tier_compiler();
+    argv[argc++] = "-O2";
+    argv[argc++] = "-march=native";
+    argv[argc++] = "-fno-omit-frame-pointer";  // Keeps :profile's stack walk intact
+    argv[argc++] = "-shared";
+    argv[argc++] = "-fPIC";
+    argv[argc++] = "-w";
+    if (include_arg[0]) argv[argc++] = include_arg;
+    argv[argc++] = "-o";
+    argv[argc++] = so_path;
+    if (project) {
+        for (size_t i = 0; i < project_units.count; i++) argv[argc++] = project_units.items[i];
+    } else {
+        argv[argc++] = "-x";
+        argv[argc++] = "c";
+        argv[argc++] = "-";
+        argv[argc++] = "-x";
+        argv[argc++] = "none";
+    }
+    for (size_t i = 0; i < loaded_libraries.count; i++) argv[argc++] = loaded_libraries.items[i].path;
+    argv[argc++] = "-lm";
+    argv[argc] = NULL;
+
+    source_message(stdout, "Building optimized image with %s -O2 -march=native...", argv[0]);
+    fflush(stdout);
+    double start = now_ms();
+    // The compiler's own diagnostics only go to the terminal from the main thread
+    int status = run_process_input(argv, project ? NULL : ctx->source_code,
+                                   source_message_func != NULL);
+    free(argv);
+
+    if (status != 0) {
+        source_message(stderr, "ERROR: %s could not build the optimized image%s", tier_compiler(),
+                       status == 127 ? " (compiler not found; set MALCREPL_CC)" : "");
+        unlink(so_path);
+        rmdir(tmp_dir);
+        return false;
+    }
+
+    ctx->tier_handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+    unlink(so_path);    // The mapping stays valid
+    rmdir(tmp_dir);
+    if (!ctx->tier_handle) {
+        source_message(stderr, "ERROR: Could not load optimized image: %s", dlerror());
+        return false;
+    }
+
+    ctx->tier_path = strdup(so_path);
+    ctx->tier_failed = false;
+    source_message(stdout, "Optimized image ready in %.2f ms", now_ms() - start);
+    return true;
+}
+
+// Route future calls of entry's function to the optimized image
+static bool tier_promote(Compiler_Context *ctx, Tier_Entry *entry) {
+    if (entry->optimized) return true;
+    if (entry->failed) return false;
+
+    if (delta_find(ctx, entry->name)) {
+        printf("'%s' was defined with :def and stays on TCC\n", entry->name);
+        entry->failed = true;
+        return false;
+    }
+    if (!compiler_image_symbol(ctx, entry->name) && library_get_symbol(entry->name)) {
+        printf("'%s' comes from a loaded library and already runs native code\n", entry->name);
+        entry->failed = true;
+        return false;
+    }
+    if (!tier_build(ctx)) {
+        entry->failed = true;
+        return false;
+    }
+    entry->optimized = image_get_symbol(ctx->tier_handle, ctx->tier_path, entry->name);
+    if (!entry->optimized) {
+        fprintf(stderr, "ERROR: '%s' is not in the optimized image\n", entry->name);
+        entry->failed = true;
+        return false;
+    }
+
+    // perf can't read the symbols of the image, it was unlinked after loading
+    Dl_info dl;
+    const ElfW(Sym) *sym = NULL;
+    if (jit_export_enabled() &&
+        dladdr1(entry->optimized, &dl, (void **)&sym, RTLD_DL_SYMENT) && sym) {
+        char name[512];
+        snprintf(name, sizeof(name), "%s [optimized]", entry->name);
+        jit_export_code(entry->optimized, sym->st_size, name);
+    }
+    call_cache_clear();
+    return true;
+}
+
+// Account for one call, promoting the function once it crosses a threshold
+static void tier_record_call(Compiler_Context *ctx, Tier_Entry *entry, double ms) {
+    entry->calls++;
+    entry->total_ms += ms;
+
+    if (!tier_auto || entry->optimized || entry->failed) return;
+    if (entry->calls < TIER_CALL_THRESHOLD && entry->total_ms < TIER_TIME_THRESHOLD_MS) return;
+
+    printf("'%s' is hot (%lu calls, %.2f ms), promoting to the optimized tier\n",
+           entry->name, entry->calls, entry->total_ms);
+    if (tier_promote(ctx, entry)) {
+        printf("'%s' now runs optimized code%s\n", entry->name,
+               ctx->alloc_hooked ? " once :allocs and :arena are off" : "");
+    }
+}
+
+// Whether a reload should rebuild the optimized image for the new source
+static bool tier_has_promotions(const Compiler_Context *ctx) {
+    for (size_t i = 0; i < ctx->tier.count; i++) {
+        if (ctx->tier.items[i].optimized) return true;
+    }
+    return false;
+}
+
+// Carry promotions over to a reloaded image. The reload thread already built
+// its optimized image (see reload_worker()), so this is a symbol lookup per
+// function; without one they run on TCC until promoted again.
+static void tier_inherit(Compiler_Context *ctx, const Compiler_Context *old) {
+    for (size_t i = 0; i < old->tier.count; i++) {
+        if (!old->tier.items[i].optimized) continue;
+        const char *name = old->tier.items[i].name;
+        if (!ctx->tier_handle || !compiler_get_symbol(ctx, name) ||
+            !tier_promote(ctx, tier_lookup(ctx, name))) {
+            printf("'%s' runs on TCC again after the reload\n", name);
+        }
+    }
+}
+
+static void tier_print_status(const Compiler_Context *ctx) {
+    printf("\nOptimizing tier (%s): auto-promotion %s, after %d calls or %.0f ms\n",
+           tier_compiler(), tier_auto ? "on" : "off",
+           TIER_CALL_THRESHOLD, TIER_TIME_THRESHOLD_MS);
+    if (ctx->tier.count == 0) {
+        printf("  No calls yet\n\n");
+        return;
+    }
+    for (size_t i = 0; i < ctx->tier.count; i++) {
+        const Tier_Entry *e = &ctx->tier.items[i];
+        printf("  %-24s calls=%-8lu time=%.2f ms  %s\n", e->name, e->calls, e->total_ms,
+               e->optimized ? "optimized" : e->failed ? "tcc (promotion failed)" : "tcc");
+    }
+    printf("\n");
+}
+
+// ============================================================================
+// Compile-Phase Profiler
+// ============================================================================
+
+static bool compile_stats_verbose = false;     // Print the breakdown after every compile
+
+static void print_compile_stats(const Compile_Stats *st) {
+    const struct { const char *label; double ms; const char *note; } rows[] = {
+        { "Fetch",           st->fetch_ms,     "read / download" },
+        { "Decrypt",         st->decrypt_ms,   "" },
+        { "Header snapshot", st->snapshot_ms,  "locate or build" },
+        { "Configure",       st->configure_ms, "include paths, libraries" },
+        { "Compile",         st->compile_ms,   "preprocess + codegen" },
+        { "Snapshot retry",  st->retry_ms,     "discarded attempt" },
+        { "Relocate/link",   st->relocate_ms,  "" },
+        { "Load image",      st->load_ms,      "dlopen" },
+    };
+
+    printf("\nCompile stats (%s):\n", st->kind ? st->kind : "unknown");
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        if (rows[i].ms <= 0.0) continue;
+        printf("  %-16s %9.2f ms  %5.1f%%  %s\n", rows[i].label, rows[i].ms,
+               st->total_ms > 0.0 ? 100.0 * rows[i].ms / st->total_ms : 0.0, rows[i].note);
+    }
+    printf("  %-16s %9.2f ms\n\n", "Total", st->total_ms);
+}
+
+// Find the next `#include` line at or after *cursor and advance past it.
+// *arg/*len receive the operand, e.g. `<stdio.h>` or `"local.h"`.
+static bool next_include_directive(const char **cursor, const char **arg, size_t *len) {
+    for (const char *p = *cursor; p && *p; ) {
+        const char *line = p;
+        const char *eol = strchr(p, '\n');
+        p = eol ? eol + 1 : NULL;
+
+        while (*line == ' ' || *line == '\t') line++;
+        if (*line != '#') continue;
+        line++;
+        while (*line == ' ' || *line == '\t') line++;
+        if (strncmp(line, "include", 7) != 0) continue;
+        line += 7;
+        while (*line == ' ' || *line == '\t') line++;
+
+        size_t n = eol ? (size_t)(eol - line) : strlen(line);
+        while (n > 0 && isspace((unsigned char)line[n - 1])) n--;
+        if (n == 0) continue;
+
+        *cursor = p;
+        *arg = line;
+        *len = n;
+        return true;
+    }
+    *cursor = NULL;
+    return false;
+}
+
+#define HEADER_COST_MAX 64
+
+typedef struct {
+    char header[256];
+    double ms;
+    bool ok;
+} Header_Cost;
+
+static int compare_header_cost(const void *a, const void *b) {
+    double x = ((const Header_Cost *)a)->ms, y = ((const Header_Cost *)b)->ms;
+    return (x < y) - (x > y);
+}
+
+// TCC reports no per-file timings, so each #include of the source is timed
+// on its own in a scratch state configured like the real compile. Headers
+// share nested includes, so the numbers overlap rather than add up.
+static void print_header_costs(const Compiler_Context *ctx) {
+    if (!ctx->source_code) {
+        printf("ERROR: No source available\n");
+        return;
+    }
+
+    Header_Cost costs[HEADER_COST_MAX];
+    size_t count = 0;
+
+    pthread_mutex_lock(&tcc_lock);
+    const char *snapshot_dir = source_wants_snapshot(ctx->source_code) ? header_snapshot_dir() : NULL;
+
+    const char *cursor = ctx->source_code, *line;
+    size_t len;
+    while (count < HEADER_COST_MAX && next_include_directive(&cursor, &line, &len)) {
+        if (len >= sizeof(costs[0].header)) continue;
+
+        Header_Cost *cost = &costs[count++];
+        snprintf(cost->header, sizeof(cost->header), "%.*s", (int)len, line);
+
+        char unit[300];
+        snprintf(unit, sizeof(unit), "#include %s\n", cost->header);
+
+        Compiler_Context *scratch = compiler_create();
+        if (!scratch) {
+            count--;
+            break;
+        }
+        Error_Log discard = {0};
+        tcc_set_error_func(scratch->state, &discard, error_log_append);
+        compiler_configure(scratch, ctx->source_path, TCC_OUTPUT_MEMORY, snapshot_dir);
+        double start = now_ms();
+        cost->ok = tcc_compile_string(scratch->state, unit) != -1;
+        cost->ms = now_ms() - start;
+        compiler_destroy(scratch);
+        da_free(&discard);
+    }
+    pthread_mutex_unlock(&tcc_lock);
+
+    if (count == 0) {
+        printf("\nNo #include directives in the source\n\n");
+        return;
+    }
+
+    qsort(costs, count, sizeof(costs[0]), compare_header_cost);
+    printf("\nStandalone include cost%s (overlapping, not additive):\n",
+           snapshot_dir ? ", via header snapshot" : "");
+    for (size_t i = 0; i < count; i++) {
+        printf("  %-32s %9.2f ms%s\n", costs[i].header, costs[i].ms,
+               costs[i].ok ? "" : "  (does not compile on its own)");
+    }
+    printf("\n");
+}
+
+// ============================================================================
+// Incremental Definitions
+// ============================================================================
+//
+// :def compiles a function or global typed at the prompt as a small extra
+// TCC unit instead of recompiling the whole source. The unit gets the
+// source's #include lines, and every file-scope symbol of the image (and of
+// earlier definitions) is handed to TCC with tcc_add_symbol(), so only the
+// new code is compiled and relocated. Lookups try the newest definition
+// first; code compiled earlier keeps calling what it was linked against.
+
+// Definitions made this session, re-applied to every reloaded image
+static String_Array session_defs = {0};
+
+static void delta_collect_defined(const char *name, Top_Level_Kind kind,
+                                  const char *where, void *ctx) {
+    (void)where;
+    String_Array *names = ctx;
+    if (kind != TOP_FUNCTION_DEF && kind != TOP_VARIABLE_DEF) return;
+    for (size_t i = 0; i < names->count; i++) {
+        if (strcmp(names->items[i], name) == 0) return;
+    }
+    da_append(names, strdup(name));
+}
+
+typedef struct {
+    Compiler_Context *ctx;
+    TCCState *state;            // Unit being linked
+    const String_Array *own;    // Names the unit defines itself
+    String_Array added;
+} Delta_Link;
+
+static void delta_link_symbol(const char *name, Top_Level_Kind kind,
+                              const char *where, void *opaque) {
+    (void)where;
+    Delta_Link *link = opaque;
+    if (kind != TOP_FUNCTION_DEF && kind != TOP_VARIABLE_DEF) return;
+
+    for (size_t i = 0; i < link->own->count; i++) {
+        if (strcmp(link->own->items[i], name) == 0) return;
+    }
+    for (size_t i = 0; i < link->added.count; i++) {
+        if (strcmp(link->added.items[i], name) == 0) return;
+    }
+
+    // Older definitions shadow the image
+    Delta_Unit *older = delta_find(link->ctx, name);
+    void *addr = older ? tcc_get_symbol(older->state, name)
+                       : compiler_image_symbol(link->ctx, name);
+    if (!addr) return;  // static, or optimized away
+
+    tcc_add_symbol(link->state, name, addr);
+    da_append(&link->added, strdup(name));
+}
+
+// Compile source as a new unit on top of ctx. Diagnostics go to compile_diag().
+static bool delta_apply(Compiler_Context *ctx, const char *source) {
+    Delta_Unit delta = {0};
+    scan_top_level(source, delta_collect_defined, &delta.names);
+    if (delta.names.count == 0) {
+        compile_diag("ERROR: :def needs a function or variable definition");
+        return false;
+    }
+
+    // The source's includes, then the definition with its own line numbers
+    size_t size = strlen(source) + 64;
+    const char *cursor = ctx->source_code, *arg;
+    size_t len;
+    while (next_include_directive(&cursor, &arg, &len)) size += len + 16;
+    char *unit_text = malloc(size);
+    if (!unit_text) return false;
+    size_t used = 0;
+    cursor = ctx->source_code;
+    while (next_include_directive(&cursor, &arg, &len)) {
+        used += snprintf(unit_text + used, size - used, "#include %.*s\n", (int)len, arg);
+    }
+    snprintf(unit_text + used, size - used, "#line 1 \"<def>\"\n%s\n", source);
+
+    pthread_mutex_lock(&tcc_lock);
+    Compiler_Context *unit = compiler_create();
+    bool ok = unit && compiler_build(unit, unit_text, ctx->source_path, TCC_OUTPUT_MEMORY);
+    if (!ok) {
+        compile_diag("ERROR: Compilation failed");
+    } else {
+        Delta_Link link = { .ctx = ctx, .state = unit->state, .own = &delta.names };
+        scan_top_level(ctx->source_code, delta_link_symbol, &link);
+        for (size_t i = 0; i < ctx->deltas.count; i++) {
+            scan_top_level(ctx->deltas.items[i].source, delta_link_symbol, &link);
+        }
+        string_array_free(&link.added);
+
+        ok = tcc_relocate(unit->state, TCC_RELOCATE_AUTO) >= 0;
+        if (!ok) compile_diag("ERROR: Relocation failed - check for undefined symbols");
+    }
+    if (ok) {
+        delta.state = unit->state;
+        unit->state = NULL;
+    }
+    compiler_destroy(unit);
+    pthread_mutex_unlock(&tcc_lock);
+    free(unit_text);
+
+    if (!ok) {
+        string_array_free(&delta.names);
+        return false;
+    }
+
+    // Promotions of redefined functions point at the old code
+    for (size_t i = 0; i < delta.names.count; i++) {
+        for (size_t j = 0; j < ctx->tier.count; j++) {
+            Tier_Entry *entry = &ctx->tier.items[j];
+            if (strcmp(entry->name, delta.names.items[i]) == 0) {
+                entry->optimized = NULL;
+                entry->failed = false;
+            }
+        }
+    }
+
+    delta.source = strdup(source);
+    da_append(&ctx->deltas, delta);
+    symbol_index_reset(&ctx->symbols);
+    return true;
+}
+
+// Drop every :def unit of ctx
+static void delta_clear(Compiler_Context *ctx) {
+    pthread_mutex_lock(&tcc_lock);
+    for (size_t i = 0; i < ctx->deltas.count; i++) {
+        Delta_Unit *delta = &ctx->deltas.items[i];
+        for (size_t j = 0; j < delta->names.count; j++) {
+            for (size_t k = 0; k < ctx->tier.count; k++) {
+                if (strcmp(ctx->tier.items[k].name, delta->names.items[j]) == 0) {
+                    ctx->tier.items[k].failed = false;
+                }
+            }
+        }
+        delta_unit_free(delta);
+    }
+    pthread_mutex_unlock(&tcc_lock);
+    ctx->deltas.count = 0;
+    symbol_index_reset(&ctx->symbols);
+    call_cache_clear();
+}
+
+// Re-apply the session's definitions to a freshly compiled image
+static void delta_reapply(Compiler_Context *ctx) {
+    for (size_t i = 0; i < session_defs.count; i++) {
+        if (!delta_apply(ctx, session_defs.items[i])) {
+            compile_diag("WARNING: :def #%zu no longer compiles against the source; skipped",
+                         i + 1);
+        }
+    }
+}
+
+// ============================================================================
+// Argument Parsing
+// ============================================================================
+
+// The lexer stores every token at the start of its string storage. Moving the
+// storage past a string literal keeps it intact, so it is passed to the
+// callee in place; the storage prepare_call() sizes to the input has room.
+static char *lexer_keep_string(stb_lexer *l) {
+    char *string = l->string;
+    l->string_storage += l->string_len + 1;
+    l->string_storage_len -= l->string_len + 1;
+    return string;
+}
+
+static bool parse_arguments(stb_lexer *l, Type_Array *types, Value_Array *values) {
+    while (stb_c_lexer_get_token(l)) {
+        switch (l->token) {
+            case CLEX_intlit: {
+                // Check suffix for long (L or LL)
+                const char *p = l->where_firstchar;
+                while (*p && (isdigit(*p) || *p == 'x' || *p == 'X' ||
+                             (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F'))) {
+                    p++;
+                }
+
+                if (*p == 'L' || *p == 'l') {
+                    da_append(types, &ffi_type_slong);
+                    long *x = temp_alloc(sizeof(long));
+                    if (!x) return false;
+                    *x = l->int_number;
+                    da_append(values, x);
+                } else {
+                    da_append(types, &ffi_type_sint32);
+                    int *x = temp_alloc(sizeof(int));
+                    if (!x) return false;
+                    *x = (int)l->int_number;
+                    da_append(values, x);
+                }
+                break;
+            }
+
+            case CLEX_dqstring: {
+                da_append(types, &ffi_type_pointer);
+                char **x = temp_alloc(sizeof(char*));
+                if (!x) return false;
+                *x = lexer_keep_string(l);
+                da_append(values, x);
+                break;
+            }
+
+            case CLEX_sqstring: {
+                if (l->string[0] && !l->string[1]) {  // Exactly one char
+                    da_append(types, &ffi_type_schar);
+                    char *x = temp_alloc(sizeof(char));
+                    if (!x) return false;
+                    *x = l->string[0];
+                    da_append(values, x);
+                } else {
+                    fprintf(stderr, "ERROR: char literal must be single character\n");
+                    return false;
+                }
+                break;
+            }
+
+            case CLEX_charlit: {
+                // Direct character literal like 'a'
+                da_append(types, &ffi_type_schar);
+                char *x = temp_alloc(sizeof(char));
+                if (!x) return false;
+                *x = (char)l->int_number;  // Character value is in int_number
+                da_append(values, x);
+                break;
+            }
+
+            case CLEX_floatlit: {
+                // Check suffix for float (f or F)
+                const char *p = l->where_firstchar;
+                while (*p && (isdigit(*p) || *p == '.' || *p == 'e' ||
+                             *p == 'E' || *p == '+' || *p == '-')) {
+                    p++;
+                }
+
+                if (*p == 'f' || *p == 'F') {
+                    da_append(types, &ffi_type_float);
+                    float *x = temp_alloc(sizeof(float));
+                    if (!x) return false;
+                    *x = (float)l->real_number;
+                    da_append(values, x);
+                } else {
+                    da_append(types, &ffi_type_double);
+                    double *x = temp_alloc(sizeof(double));
+                    if (!x) return false;
+                    *x = l->real_number;
+                    da_append(values, x);
+                }
+                break;
+            }
+
+            default:
+                fprintf(stderr, "ERROR: unsupported argument type (token: %ld)\n", l->token);
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+// ============================================================================
+// Argument Marshalling
+// ============================================================================
+//
+// Literal syntax alone can't tell `5` for a long from `5` for an int, so a
+// function whose parameter list is understood gets a marshalling plan when
+// the symbol index is built: the declared type, width and offset of every
+// parameter in a preallocated argument block. Calls through a plan convert
+// each literal to the declared type (as a C call would) and write it
+// straight into the block. Functions without a plan (variadic, unknown
+// typedefs, structs by value, library functions) keep literal typing.
+
+typedef struct {
+    const char *name;
+    ffi_type *type;
+} Known_Typedef;
+
+static const Known_Typedef known_typedefs[] = {
+    {"size_t", &ffi_type_ulong},    {"ssize_t", &ffi_type_slong},
+    {"ptrdiff_t", &ffi_type_slong}, {"intptr_t", &ffi_type_slong},
+    {"uintptr_t", &ffi_type_ulong}, {"off_t", &ffi_type_slong},
+    {"int8_t", &ffi_type_sint8},    {"uint8_t", &ffi_type_uint8},
+    {"int16_t", &ffi_type_sint16},  {"uint16_t", &ffi_type_uint16},
+    {"int32_t", &ffi_type_sint32},  {"uint32_t", &ffi_type_uint32},
+    {"int64_t", &ffi_type_sint64},  {"uint64_t", &ffi_type_uint64},
+    {NULL, NULL}
+};
+
+// FFI type of one parameter declaration ("const unsigned long n"), or NULL
+static ffi_type *marshal_param_type(const char *decl, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (decl[i] == '*' || decl[i] == '[' || decl[i] == '(') return &ffi_type_pointer;
+    }
+
+    bool is_unsigned = false, is_char = false, is_short = false, is_bool = false;
+    bool is_float = false, is_double = false, is_int = false, seen_type = false;
+    int longs = 0;
+    ffi_type *named = NULL;
+
+    const char *p = decl, *end = decl + len;
+    while (p < end) {
+        if (!isalnum((unsigned char)*p) && *p != '_') {
+            p++;
+            continue;
+        }
+        const char *word = p;
+        while (p < end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+        String_View w = { .data = word, .count = (size_t)(p - word) };
+
+        if (sv_eq(w, sv_from_cstr("const")) || sv_eq(w, sv_from_cstr("volatile")) ||
+            sv_eq(w, sv_from_cstr("register")) || sv_eq(w, sv_from_cstr("restrict"))) {
+            continue;
+        }
+        if (sv_eq(w, sv_from_cstr("struct")) || sv_eq(w, sv_from_cstr("union"))) return NULL;
+        if (sv_eq(w, sv_from_cstr("enum"))) {
+            // Skip the tag; enums are passed as int
+            while (p < end && isspace((unsigned char)*p)) p++;
+            while (p < end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+            is_int = seen_type = true;
+            continue;
+        }
+
+        seen_type = true;
+        if (sv_eq(w, sv_from_cstr("unsigned"))) is_unsigned = true;
+        else if (sv_eq(w, sv_from_cstr("signed"))) {}
+        else if (sv_eq(w, sv_from_cstr("int"))) is_int = true;
+        else if (sv_eq(w, sv_from_cstr("char"))) is_char = true;
+        else if (sv_eq(w, sv_from_cstr("short"))) is_short = true;
+        else if (sv_eq(w, sv_from_cstr("long"))) longs++;
+        else if (sv_eq(w, sv_from_cstr("float"))) is_float = true;
+        else if (sv_eq(w, sv_from_cstr("double"))) is_double = true;
+        else if (sv_eq(w, sv_from_cstr("_Bool")) || sv_eq(w, sv_from_cstr("bool"))) is_bool = true;
+        else {
+            bool has_base = named || is_unsigned || is_int || is_char || is_short || longs ||
+                            is_float || is_double || is_bool;
+            if (has_base) continue;  // The parameter name
+            for (size_t i = 0; known_typedefs[i].name; i++) {
+                if (sv_eq(w, sv_from_cstr(known_typedefs[i].name))) named = known_typedefs[i].type;
+            }
+            if (!named) return NULL;  // A typedef we can't see through
+        }
+    }
+
+    if (named) return named;
+    if (!seen_type) return NULL;
+    if (is_double) return longs ? NULL : &ffi_type_double;  // No long double
+    if (is_float) return &ffi_type_float;
+    if (is_bool) return &ffi_type_uint8;
+    if (is_char) return is_unsigned ? &ffi_type_uint8 : &ffi_type_schar;
+    if (is_short) return is_unsigned ? &ffi_type_uint16 : &ffi_type_sint16;
+    if (longs) return is_unsigned ? &ffi_type_ulong : &ffi_type_slong;
+    return is_unsigned ? &ffi_type_uint32 : &ffi_type_sint32;
+}
+
+// Build the plan for name's signature, e.g. "int add(int a, long b)".
+// Leaves plan->known false when any parameter isn't understood.
+static void marshal_plan_build(Marshal_Plan *plan, const char *signature, const char *name) {
+    memset(plan, 0, sizeof(*plan));
+    if (!signature) return;
+
+    // The parameter list follows the name itself (the return type may have
+    // parentheses of its own)
+    size_t name_len = strlen(name);
+    const char *p = signature;
+    for (;;) {
+        p = strstr(p, name);
+        if (!p) return;
+        const char *after = p + name_len;
+        while (isspace((unsigned char)*after)) after++;
+        bool starts_word = p == signature || !(isalnum((unsigned char)p[-1]) || p[-1] == '_');
+        if (starts_word && *after == '(') {
+            p = after + 1;
+            break;
+        }
+        p += name_len;
+    }
+
+    size_t offset = 0;
+    for (;;) {
+        while (isspace((unsigned char)*p)) p++;
+        const char *start = p;
+        int depth = 0;
+        while (*p && (depth > 0 || (*p != ',' && *p != ')'))) {
+            if (*p == '(') depth++;
+            if (*p == ')') depth--;
+            p++;
+        }
+        if (!*p) return;
+        size_t len = (size_t)(p - start);
+        while (len > 0 && isspace((unsigned char)start[len - 1])) len--;
+
+        String_View param = { .data = start, .count = len };
+        if (len == 0 || sv_eq(param, sv_from_cstr("void"))) {
+            if (plan->count > 0 || *p != ')') return;  // "(int, )" and the like
+        } else {
+            if (sv_eq(param, sv_from_cstr("..."))) return;  // Variadic
+            if (plan->count >= MARSHAL_MAX_ARGS) return;
+            ffi_type *type = marshal_param_type(start, len);
+            if (!type) return;
+            offset = (offset + type->alignment - 1) & ~(size_t)(type->alignment - 1);
+            plan->types[plan->count] = type;
+            plan->offsets[plan->count] = offset;
+            plan->count++;
+            offset += type->size;
+        }
+        if (*p == ')') break;
+        p++;
+    }
+
+    plan->block = malloc(offset ? offset : 1);
+    plan->known = plan->block != NULL;
+}
+
+static void marshal_store(void *dst, ffi_type *type, bool is_real, long long ival, double rval) {
+    if (type == &ffi_type_double) {
+        *(double *)dst = is_real ? rval : (double)ival;
+    } else if (type == &ffi_type_float) {
+        *(float *)dst = is_real ? (float)rval : (float)ival;
+    } else {
+        long long v = is_real ? (long long)rval : ival;
+        switch (type->size) {
+            case 1: *(int8_t *)dst = (int8_t)v; break;
+            case 2: *(int16_t *)dst = (int16_t)v; break;
+            case 4: *(int32_t *)dst = (int32_t)v; break;
+            default: *(int64_t *)dst = (int64_t)v; break;
+        }
+    }
+}
+
+// parse_arguments() for a function with a plan: values point into the
+// plan's block and types are the declared parameter types
+static bool marshal_arguments(stb_lexer *l, const char *name, Marshal_Plan *plan,
+                              Type_Array *types, Value_Array *values) {
+    unsigned index = 0;
+    while (stb_c_lexer_get_token(l)) {
+        if (index >= plan->count) {
+            fprintf(stderr, "ERROR: %s takes %u argument(s)\n", name, plan->count);
+            return false;
+        }
+        ffi_type *type = plan->types[index];
+        void *dst = plan->block + plan->offsets[index];
+
+        switch (l->token) {
+            case CLEX_intlit:
+            case CLEX_charlit:
+            case CLEX_floatlit:
+            case CLEX_sqstring: {
+                bool is_real = l->token == CLEX_floatlit;
+                long long ival = l->token == CLEX_sqstring ? l->string[0] : l->int_number;
+                if (l->token == CLEX_sqstring && (!l->string[0] || l->string[1])) {
+                    fprintf(stderr, "ERROR: char literal must be single character\n");
+                    return false;
+                }
+                if (type == &ffi_type_pointer) {
+                    if (is_real || ival != 0) {
+                        fprintf(stderr, "ERROR: argument %u of %s is a pointer\n", index + 1, name);
+                        return false;
+                    }
+                    *(void **)dst = NULL;
+                } else {
+                    marshal_store(dst, type, is_real, ival, l->real_number);
+                }
+                break;
+            }
+
+            case CLEX_dqstring: {
+                if (type != &ffi_type_pointer) {
+                    fprintf(stderr, "ERROR: argument %u of %s is not a pointer\n", index + 1, name);
+                    return false;
+                }
+                *(char **)dst = lexer_keep_string(l);
+                break;
+            }
+
+            default:
+                fprintf(stderr, "ERROR: unsupported argument type (token: %ld)\n", l->token);
+                return false;
+        }
+        da_append(types, type);
+        da_append(values, dst);
+        index++;
+    }
+
+    if (index != plan->count) {
+        fprintf(stderr, "ERROR: %s takes %u argument(s), got %u\n", name, plan->count, index);
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// Return Type Autodetection
+// ============================================================================
+
+// Function to find the start of return type
+const char* find_return_type_start(const char* code, const char* func_pos) {
+    const char* p = func_pos;
+
+    // Move backwards to find the start of function declaration
+    while (p > code && *p != ';' && *p != '}' && *p != '{' && *p != '\n') {
+        p--;
+    }
+
+    // Skip the delimiter we found
+    if (p > code || *p == ';' || *p == '}' || *p == '{' || *p == '\n') {
+        p++;
+    }
+
+    return p;
+}
+
+bool extract_return_type(const char* code, const char* func_name, char* return_type, size_t return_type_size) {
+    if (!code || !func_name || !return_type || return_type_size == 0) {
+        return false;
+    }
+
+    // Build search pattern: look for "function_name("
+    char pattern[256];
+    snprintf(pattern, sizeof(pattern), "%s(", func_name);
+
+    const char *func_decl = strstr(code, pattern);
+    if (!func_decl) {
+        return false;
+    }
+
+    // Walk backwards to find start of return type
+    const char *p = func_decl - 1;
+
+    // Skip whitespace before function name
+    while (p > code && isspace((unsigned char)*p)) {
+        p--;
+    }
+
+    // Now p points to last char of return type
+    const char *ret_end = p + 1;
+
+    // Walk backwards to find start of return type
+    // Stop at: newline, semicolon, closing brace, opening brace
+    while (p > code) {
+        char c = *p;
+        if (c == '\n' || c == ';' || c == '}' || c == '{') {
+            p++;
+            break;
+        }
+        p--;
+    }
+
+    // Skip leading whitespace
+    while (p < ret_end && isspace((unsigned char)*p)) {
+        p++;
+    }
+
+    // Calculate length
+    size_t len = ret_end - p;
+
+    if (len == 0 || len >= return_type_size) {
+        return false;
+    }
+
+    // Copy return type
+    memcpy(return_type, p, len);
+    return_type[len] = '\0';
+
+    // Trim trailing whitespace
+    while (len > 0 && isspace((unsigned char)return_type[len - 1])) {
+        return_type[--len] = '\0';
+    }
+
+    return len > 0;
+}
+
+static ffi_type* detect_return_type(const char *function_name, const char *source_code) {
+    char return_type_str[64];
+    memset(return_type_str, 0, sizeof(return_type_str));
+
+    if (!extract_return_type(source_code, function_name, return_type_str, sizeof(return_type_str))) {
+        // Default to int if we can't detect
+        return &ffi_type_sint;
+    }
+
+    // Trim whitespace
+    String_View rt = sv_trim(sv_from_cstr(return_type_str));
+
+    // Check for void
+    if (rt.count == 4 && memcmp(rt.data, "void", 4) == 0) {
+        return &ffi_type_void;
+    }
+
+    // Check for pointer types (look for asterisk)
+    for (size_t i = 0; i < rt.count; i++) {
+        if (rt.data[i] == '*') {
+            return &ffi_type_pointer;
+        }
+    }
+
+    // Check for char (single character, not pointer)
+    if (rt.count == 4 && memcmp(rt.data, "char", 4) == 0) {
+        return &ffi_type_schar;
+    }
+
+    // Check for int types
+    if ((rt.count == 3 && memcmp(rt.data, "int", 3) == 0) ||
+        (rt.count == 5 && memcmp(rt.data, "short", 5) == 0) ||
+        (rt.count >= 6 && memcmp(rt.data, "signed", 6) == 0) ||
+        (rt.count >= 8 && memcmp(rt.data, "unsigned", 8) == 0)) {
+        return &ffi_type_sint;
+    }
+
+    // Check for long
+    if (rt.count == 4 && memcmp(rt.data, "long", 4) == 0) {
+        return &ffi_type_slong;
+    }
+
+    // Check for float
+    if (rt.count == 5 && memcmp(rt.data, "float", 5) == 0) {
+        return &ffi_type_float;
+    }
+
+    // Check for double
+    if (rt.count == 6 && memcmp(rt.data, "double", 6) == 0) {
+        return &ffi_type_double;
+    }
+
+    // Default: assume int
+    return &ffi_type_sint;
+}
+
+// note (e.g. :time's figures) goes at the end of the line
+static void display_return_value(ffi_type *return_type, void *result, const char *note) {
+    if (!result && return_type != &ffi_type_void) {
+        return;
+    }
+
+    // Match by type size and alignment as backup
+    int is_char = (return_type == &ffi_type_schar) ||
+                  (return_type == &ffi_type_sint8) ||
+                  (return_type == &ffi_type_uint8) ||
+                  (return_type->size == 1 && return_type->alignment == 1);
+
+    int is_int = (return_type == &ffi_type_sint) ||
+                 (return_type == &ffi_type_sint32) ||
+                 (return_type == &ffi_type_uint32);
+
+    int is_long = (return_type == &ffi_type_slong) ||
+                  (return_type == &ffi_type_sint64);
+
+    if (return_type == &ffi_type_void) {
+        // Only the note, if any, for void
+        if (note[0]) printf("→ (void)%s\n", note);
+    } else if (is_char) {
+        char c = *(char*)result;
+        if (isprint((unsigned char)c)) {
+            printf("→ '%c' (%d)%s\n", c, (int)c, note);
+        } else {
+            printf("→ %d (non-printable)%s\n", (int)c, note);
+        }
+    } else if (is_int) {
+        printf("→ %d%s\n", *(int*)result, note);
+    } else if (is_long) {
+        printf("→ %ld%s\n", *(long*)result, note);
+    } else if (return_type == &ffi_type_float) {
+        printf("→ %f%s\n", *(float*)result, note);
+    } else if (return_type == &ffi_type_double) {
+        printf("→ %lf%s\n", *(double*)result, note);
+    } else if (return_type == &ffi_type_pointer) {
+        void *ptr = *(void**)result;
+
+        if (!ptr) {
+            printf("→ NULL%s\n", note);
+        } else {
+            // Try to display as string
+            const char *str = (const char*)ptr;
+            size_t len = 0;
+
+            // Check if it looks like a string
+            while (len < 256 && str[len]) {
+                if (!isprint((unsigned char)str[len]) && !isspace((unsigned char)str[len])) {
+                    // Not a string
+                    printf("→ %p%s\n", ptr, note);
+                    return;
+                }
+                len++;
+            }
+
+            if (len > 0 && len < 256) {
+                printf("→ \"%s\"%s\n", str, note);
+            } else {
+                printf("→ %p%s\n", ptr, note);
+            }
+        }
+    } else {
+        printf("→ [unknown type, size=%zu]%s\n", return_type->size, note);
+    }
+}
+
+// ============================================================================
+// Symbol Index
+// ============================================================================
+//
+// One sorted table per image of everything the source (and its :def units)
+// defines at file scope, with resolved address and size. TCC 0.9.27 can't
+// enumerate a relocated state, so names come from the file-scope scan and
+// are resolved once each; sizes come from the ELF symbol table for dlopen()ed
+// images and from the distance to the next function for in-memory units.
+// Built on first use after each compile, so :list and completion don't
+// rescan the source.
+
+// Signature text of the declaration whose name starts at name_at: from the
+// start of the declaration up to the closing parenthesis, whitespace collapsed
+static bool extract_signature_at(const char *source, const char *name_at, size_t name_len,
+                                 char *signature, size_t sig_size) {
+    if (!source || !name_at || !signature || sig_size == 0) return false;
+
+    // Find start of signature (walk back to find return type)
+    const char *sig_start = name_at;
+    while (sig_start > source &&
+           *sig_start != '\n' && *sig_start != ';' &&
+           *sig_start != '}' && *sig_start != '{') {
+        sig_start--;
+    }
+    if (*sig_start == '\n' || *sig_start == ';' || *sig_start == '}' || *sig_start == '{') {
+        sig_start++;
+    }
+
+    // Skip leading whitespace
+    while (*sig_start && isspace((unsigned char)*sig_start)) {
+        sig_start++;
+    }
+
+    // Find end of signature (closing paren)
+    const char *sig_end = name_at + name_len;
+    while (*sig_end && *sig_end != '(') sig_end++;
+    if (!*sig_end) return false;
+    sig_end++;
+    int paren_depth = 1;
+    while (*sig_end && paren_depth > 0) {
+        if (*sig_end == '(') paren_depth++;
+        if (*sig_end == ')') paren_depth--;
+        sig_end++;
+    }
+
+    // Calculate length and copy
+    size_t len = sig_end - sig_start;
+    if (len >= sig_size) {
+        len = sig_size - 1;
+    }
+
+    memcpy(signature, sig_start, len);
+    signature[len] = '\0';
+
+    // Clean up extra whitespace
+    char *dst = signature;
+    const char *src = signature;
+    int last_was_space = 0;
+
+    while (*src) {
+        if (isspace((unsigned char)*src)) {
+            if (!last_was_space && dst != signature) {
+                *dst++ = ' ';
+            }
+            last_was_space = 1;
+        } else {
+            *dst++ = *src;
+            last_was_space = 0;
+        }
+        src++;
+    }
+    *dst = '\0';
+
+    return true;
+}
+
+typedef struct {
+    Symbol_Index *index;
+    const char *source;
+    unsigned unit;
+} Symbol_Collect;
+
+static void symbol_collect(const char *name, Top_Level_Kind kind, const char *where, void *ctx) {
+    Symbol_Collect *collect = ctx;
+    if (kind != TOP_FUNCTION_DEF && kind != TOP_VARIABLE_DEF) return;
+
+    Symbol_Info info = {
+        .name = strdup(name),
+        .is_function = kind == TOP_FUNCTION_DEF,
+        .unit = collect->unit,
+    };
+    if (info.is_function) {
+        char signature[512];
+        if (extract_signature_at(collect->source, where, strlen(name), signature, sizeof(signature))) {
+            info.signature = strdup(signature);
+            marshal_plan_build(&info.plan, info.signature, info.name);
+        }
+    }
+    da_append(collect->index, info);
+}
+
+// By name, newest unit first, so the definition that wins comes first
+static int compare_symbol_name(const void *a, const void *b) {
+    const Symbol_Info *x = a, *y = b;
+    int c = strcmp(x->name, y->name);
+    if (c != 0) return c;
+    return (x->unit < y->unit) - (x->unit > y->unit);
+}
+
+static int compare_symbol_address(const void *a, const void *b) {
+    const Symbol_Info *x = *(Symbol_Info *const *)a, *y = *(Symbol_Info *const *)b;
+    if (x->unit != y->unit) return x->unit < y->unit ? -1 : 1;
+    return ((uintptr_t)x->addr > (uintptr_t)y->addr) - ((uintptr_t)x->addr < (uintptr_t)y->addr);
+}
+
+static void symbol_index_build(Compiler_Context *ctx) {
+    Symbol_Index *index = &ctx->symbols;
+    symbol_index_reset(index);
+    index->built = true;
+
+    Symbol_Collect collect = { index, ctx->source_code, 0 };
+    scan_top_level(ctx->source_code, symbol_collect, &collect);
+    for (size_t i = 0; i < ctx->deltas.count; i++) {
+        collect.source = ctx->deltas.items[i].source;
+        collect.unit = (unsigned)(i + 1);
+        scan_top_level(collect.source, symbol_collect, &collect);
+    }
+
+    // Keep the winning definition of each name that resolves (not static)
+    qsort(index->items, index->count, sizeof(Symbol_Info), compare_symbol_name);
+    size_t kept = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        Symbol_Info *info = &index->items[i];
+        bool shadowed = kept > 0 && strcmp(index->items[kept - 1].name, info->name) == 0;
+        info->addr = shadowed ? NULL : compiler_get_symbol(ctx, info->name);
+        if (!info->addr) {
+            free(info->name);
+            free(info->signature);
+            free(info->plan.block);
+            continue;
+        }
+        index->items[kept++] = *info;
+    }
+    index->count = kept;
+
+    // Sizes: ELF st_size where there is a symbol table, otherwise the gap
+    // to the next function of the same unit. The gap is only an upper
+    // bound: static helpers and padding after the function fall into it.
+    // The last function of a unit stays unsized.
+    Symbol_Info **by_address = malloc((kept ? kept : 1) * sizeof(Symbol_Info *));
+    if (!by_address) return;
+    size_t functions = 0;
+    for (size_t i = 0; i < kept; i++) {
+        Symbol_Info *info = &index->items[i];
+        Dl_info dl;
+        const ElfW(Sym) *sym = NULL;
+        if (info->unit == 0 && ctx->image_handle &&
+            dladdr1(info->addr, &dl, (void **)&sym, RTLD_DL_SYMENT) && sym) {
+            info->size = sym->st_size;
+            info->size_exact = true;
+        } else if (info->is_function) {
+            by_address[functions++] = info;
+        }
+    }
+    qsort(by_address, functions, sizeof(Symbol_Info *), compare_symbol_address);
+    for (size_t i = 0; i + 1 < functions; i++) {
+        if (by_address[i]->unit == by_address[i + 1]->unit) {
+            by_address[i]->size = (uintptr_t)by_address[i + 1]->addr - (uintptr_t)by_address[i]->addr;
+        }
+    }
+    free(by_address);
+}
+
+static int compare_symbol_key(const void *key, const void *item) {
+    return strcmp(key, ((const Symbol_Info *)item)->name);
+}
+
+static Symbol_Info *symbol_index_find(Compiler_Context *ctx, const char *name) {
+    if (!ctx->symbols.built) symbol_index_build(ctx);
+    return bsearch(name, ctx->symbols.items, ctx->symbols.count, sizeof(Symbol_Info),
+                   compare_symbol_key);
+}
+
+// Describe the functions of units >= first_unit to perf (--perf-map,
+// --jitdump). A cached image is left out: perf reads its .so like any other,
+// unless it was loaded from a private copy that no longer exists.
+static void jit_export_context(Compiler_Context *ctx, unsigned first_unit) {
+    if (!jit_export_enabled()) return;
+    if (!ctx->symbols.built) symbol_index_build(ctx);
+
+    for (size_t i = 0; i < ctx->symbols.count; i++) {
+        const Symbol_Info *info = &ctx->symbols.items[i];
+        if (!info->is_function || info->unit < first_unit) continue;
+        if (info->unit == 0 && ctx->image_handle && !ctx->image_private) continue;
+        // In-memory code: the gap to the next indexed function also covers
+        // static helpers (never indexed) that follow, so the entry ends at
+        // the epilogue; the gap only bounds the scan
+        size_t size = info->size;
+        if (!info->size_exact) {
+            size_t measured = tcc_code_size(info->addr, info->size);
+            if (measured) size = measured;
+        }
+        jit_export_code(info->addr, size, info->name);
+    }
+}
+
+// ============================================================================
+// Function Listing
+// ============================================================================
+
+// List all functions in the compiled source
+static void list_functions(Compiler_Context *compiler) {
+    if (!compiler || !compiler->source_code) {
+        printf("ERROR: No compiled source available\n");
+        return;
+    }
+    if (!compiler->symbols.built) symbol_index_build(compiler);
+
+    size_t count = 0;
+    for (size_t i = 0; i < compiler->symbols.count; i++) {
+        if (compiler->symbols.items[i].is_function) count++;
+    }
+
+    // Display functions
+    if (count == 0) {
+        printf("\nNo callable functions found.\n\n");
+    } else {
+        printf("\n╔════════════════════════════════════════════════════════════╗\n");
+        printf("║  Available Functions (%zu)%*s║\n", count,
+               (int)(37 - snprintf(NULL, 0, "%zu", count)), "");
+        printf("╠════════════════════════════════════════════════════════════╣\n");
+
+        for (size_t i = 0; i < compiler->symbols.count; i++) {
+            const Symbol_Info *info = &compiler->symbols.items[i];
+            if (!info->is_function) continue;
+            const char *signature = info->signature ? info->signature : info->name;
+            // A gap-derived size also covers the static helpers and padding
+            // that follow the function, so it is only shown as a bound
+            if (info->size > 0) {
+                printf("  %-58s %6zu B%s\n", signature, info->size,
+                       info->size_exact ? "" : " max");
+            } else {
+                printf("  %s\n", signature);
+            }
+        }
+
+        printf("╚════════════════════════════════════════════════════════════╝\n\n");
+    }
+}
+
+// ============================================================================
+// REPL Commands
+// ============================================================================
+
+static void print_help(void) {
+    printf("\nBuiltin commands:\n"
+           "  :help, :h   - Show this help message\n"
+           "  :quit, :q   - Exit the REPL\n"
+           "  :info       - Show compilation info\n"
+           "  :list, :l   - List all available functions\n"
+           "  :reload, :r - Reload and recompile source file in the background\n"
+           "  :watch [on|off] - Recompile automatically when the source changes\n"
+           "  :optimize fn    - Serve fn from an image built by the system compiler at -O2\n"
+           "  :tier [on|off]  - Show tier stats / promote hot functions automatically\n"
+           "  :compile-stats [on|off|headers] - Time spent per compile stage\n"
+           "  :load [lib]     - Attach a prebuilt .so/.a/.o (no argument: list them)\n"
+           "  :def <code>     - Compile a new function or global into the running image\n"
+           "  :def [clear]    - List / drop the definitions made with :def\n"
+           "  :time [on|off]  - Print each call's REPL overhead and time inside the function\n"
+           "  :rusage [on|off] - Page faults, context switches and RSS growth of each call\n"
+           "  :counters [on|off] - Cycles, instructions, IPC and misses for calls and :bench\n"
+           "  :allocs [on|off] - Count malloc/free of each call, peak live bytes and leaks\n"
+           "  :arena [on|off]  - Serve malloc from a bump arena reset after every call\n"
+           "  :arena fn args... - Run one call on the bump arena\n"
+           "  :profile [-n N] [--wall] [--folded file] fn args... - Sample fn and list where its time goes\n"
+           "  :bench [--native] [-n N] [-w W] fn args... - Time N calls of fn after W warmup calls\n"
+           "\nFunction call format:\n"
+           "  function_name [args...]\n"
+           "\nSupported argument types:\n"
+           "  - Integers: 42, -10, 100L (long)\n"
+           "  - Floats: 3.14, 2.5f (float), 1.0 (double)\n"
+           "  - Strings: \"hello world\"\n"
+           "  - Characters: 'a', 'Z'\n\n");
+}
+
+// ============================================================================
+// Readline History Support
+// ============================================================================
+
+#ifdef HAVE_READLINE
+
+// History file location
+static char history_file_path[512];
+
+// Global pointer to compiler context for completion
+static Compiler_Context *g_compiler_for_completion = NULL;
+
+// Initialize readline and history
+static void init_readline_history(void) {
+    const char *home = getenv("HOME");
+    if (home) {
+        snprintf(history_file_path, sizeof(history_file_path), 
+                "%s/.malcrepl_history", home);
+        read_history(history_file_path);
+        stifle_history(1000);
+    }
+}
+
+// Save history on exit
+static void save_readline_history(void) {
+    if (history_file_path[0] != '\0') {
+        write_history(history_file_path);
+    }
+}
+
+// Custom completion generator for REPL commands
+static char *command_generator(const char *text, int state) {
+    static const char *commands[] = {
+        ":help", ":h", ":quit", ":q", ":info", 
+        ":list", ":l", ":reload", ":r", ":watch",
+        ":optimize", ":tier", ":compile-stats", ":load", ":def", ":bench", ":time", ":counters", ":rusage", ":allocs", ":arena", ":profile", NULL
+    };
+    static int list_index;
+    static size_t len;
+    
+    if (!state) {
+        list_index = 0;
+        len = strlen(text);
+    }
+    
+    const char *name;
+    while ((name = commands[list_index++])) {
+        if (strncmp(name, text, len) == 0) {
+            return strdup(name);
+        }
+    }
+    return NULL;
+}
+
+// Names of all callable functions, from the symbol index
+static char **get_function_names(Compiler_Context *compiler, size_t *count) {
+    *count = 0;
+    if (!compiler || !compiler->source_code) return NULL;
+    if (!compiler->symbols.built) symbol_index_build(compiler);
+
+    char **names = malloc((compiler->symbols.count + 1) * sizeof(char*));
+    if (!names) return NULL;
+
+    for (size_t i = 0; i < compiler->symbols.count; i++) {
+        const Symbol_Info *info = &compiler->symbols.items[i];
+        if (!info->is_function) continue;
+        names[*count] = strdup(info->name);
+        if (names[*count]) (*count)++;
+    }
+    return names;
+}
+
+// Function name completion generator
+static char *function_generator(const char *text, int state) {
+    static char **function_names = NULL;
+    static size_t function_count = 0;
+    static size_t list_index;
+    static size_t len;
+    
+    // Initialize on first call
+    if (!state) {
+        // Free previous list if it exists
+        if (function_names) {
+            for (size_t i = 0; i < function_count; i++) {
+                free(function_names[i]);
+            }
+            free(function_names);
+            function_names = NULL;
+        }
+        
+        // Get fresh function list
+        if (g_compiler_for_completion) {
+            function_names = get_function_names(g_compiler_for_completion, &function_count);
+        }
+        
+        list_index = 0;
+        len = strlen(text);
+    }
+    
+    // Return matching functions
+    while (list_index < function_count) {
+        const char *name = function_names[list_index++];
+        if (strncmp(name, text, len) == 0) {
+            return strdup(name);
+        }
+    }
+    
+    // Cleanup when done
+    if (function_names) {
+        for (size_t i = 0; i < function_count; i++) {
+            free(function_names[i]);
+        }
+        free(function_names);
+        function_names = NULL;
+        function_count = 0;
+    }
+    
+    return NULL;
+}
+
+// Combined completion: commands + functions
+static char *combined_generator(const char *text, int state) {
+    static int phase = 0;  // 0 = commands, 1 = functions
+    
+    if (!state) {
+        phase = 0;
+    }
+    
+    // Try commands first
+    if (phase == 0) {
+        char *result = command_generator(text, state);
+        if (result) {
+            return result;
+        }
+        // Commands exhausted, move to functions
+        phase = 1;
+        state = 0;  // Reset state for function generator
+    }
+    
+    // Try functions
+    return function_generator(text, state);
+}
+
+// Completion function
+static char **repl_command_completion(const char *text, int start, int end) {
+    (void)end;
+    
+    // Always try completion at start of line
+    if (start == 0) {
+        // If text starts with ':', complete commands only
+        if (text[0] == ':') {
+            return rl_completion_matches(text, command_generator);
+        }
+        // Otherwise complete both commands and functions
+        return rl_completion_matches(text, combined_generator);
+    }
+    
+    // Suppress default filename completion
+    rl_attempted_completion_over = 1;
+    return NULL;
+}
+
+// Setup completion
+static void setup_readline_completion(Compiler_Context *compiler) {
+    // Store compiler context globally for completion
+    g_compiler_for_completion = compiler;
+    
+    // Set our custom completion function
+    rl_attempted_completion_function = repl_command_completion;
+}
+
+#endif // HAVE_READLINE
+
+// ============================================================================
+// Background Reload
+// ============================================================================
+//
+// :reload fetches, decrypts and compiles on a worker thread into a fresh
+// Compiler_Context while the REPL keeps serving calls from the current one.
+// The finished context is installed on the main thread (between calls), so
+// a call always sees either the old image or the new one, never a mix.
+
+// Context serving REPL calls. Only the main thread reads or replaces it.
+static Compiler_Context *active_compiler = NULL;
+
+static unsigned reload_count = 0;       // Successful reloads this session
+static size_t baseline_rss = 0;         // RSS once the first image was ready
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_t thread;
+    bool running;               // Worker started and not yet collected
+    bool done;                  // Worker finished, result/errors are ready
+    char *source_path;
+    int encryption_mode;
+    char *key;                  // Decryption key (encryption_mode == 0)
+    Compiler_Context *result;   // NULL if the reload failed
+    Error_Log errors;
+    double elapsed_ms;
+    bool drop_library;          // Started by :load; detach the artifact if the link fails
+    bool tier_rebuild;          // Functions are promoted; build the new optimized image too
+} Reload_Job;
+
+static Reload_Job reload_job = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void *reload_worker(void *arg) {
+    Reload_Job *job = arg;
+    Error_Log errors = {0};
+    diag_sink = &errors;
+    // Fetch and decrypt messages too: reload_poll() prints them all between calls
+    source_message_func = error_log_append;
+    source_message_opaque = &errors;
+    double start = now_ms();
+
+    Compiler_Context *compiler = NULL;
+    char *source_code = project_units.count > 0
+        ? project_read_sources(&project_units)
+        : reload_source(job->source_path, job->encryption_mode, job->key);
+    if (source_code) {
+        compiler = compile_source(source_code, job->source_path, job->encryption_mode != 0);
+        if (compiler) {
+            compiler->source_code = source_code;
+            delta_reapply(compiler);
+            // Off the main thread, so the first call after the reload doesn't wait for cc
+            if (job->tier_rebuild) tier_build(compiler);
+        } else {
+            free(source_code);
+        }
     }
-    
+    diag_sink = NULL;
+    source_message_func = NULL;
+    source_message_opaque = NULL;
+
+    pthread_mutex_lock(&job->lock);
+    job->result = compiler;
+    job->errors = errors;
+    job->elapsed_ms = now_ms() - start;
+    job->done = true;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+static void reload_job_reset(Reload_Job *job) {
+    if (job->key) {
+        memset(job->key, 0, strlen(job->key));
+        free(job->key);
+    }
+    free(job->source_path);
+    da_free(&job->errors);
+    job->key = NULL;
+    job->source_path = NULL;
+    job->result = NULL;
+    job->done = false;
+    job->running = false;
+    job->drop_library = false;
+}
+
+static bool reload_start(const char *source_path, int encryption_mode) {
+    if (reload_job.running) {
+        printf("Reload already in progress\n");
+        return false;
+    }
+
+    // The key prompt needs the terminal, so it stays on the main thread
+    char *key = NULL;
+    if (encryption_mode == 0) {
+        key = get_key_from_user();
+        if (!key) {
+            printf("ERROR: Failed to get decryption key\n");
+            return false;
+        }
+    }
+
+    // Pick up files added to or removed from a project directory
+    if (project_dir && !project_scan_directory(project_dir, &project_units)) {
+        printf("ERROR: No .c files found in '%s'\n", project_dir);
+        free(key);
+        return false;
+    }
+
+    reload_job.source_path = strdup(source_path);
+    reload_job.encryption_mode = encryption_mode;
+    reload_job.key = key;
+    reload_job.result = NULL;
+    reload_job.done = false;
+    reload_job.tier_rebuild = active_compiler && tier_has_promotions(active_compiler);
+
+    // Paths resolved lazily on first use; settle them before the worker
+    // shares them with main-thread TCC calls
+    cache_dir();
+    find_tcc_include_path();
+
+    // Keep Ctrl+C on the main thread, where the readline-aware handler belongs
+    sigset_t block, old_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &old_mask);
+    int rc = pthread_create(&reload_job.thread, NULL, reload_worker, &reload_job);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (rc != 0) {
+        printf("ERROR: Could not start reload thread\n");
+        reload_job_reset(&reload_job);
+        return false;
+    }
+
+    reload_job.running = true;
+    printf("Reloading %s in the background...\n", source_path);
+    return true;
+}
+
+// Install a finished reload, if any. Must run on the main thread between
+// calls. at_prompt: readline is showing a prompt that needs redrawing.
+static bool reload_poll(bool at_prompt) {
+    if (!reload_job.running) return false;
+
+    pthread_mutex_lock(&reload_job.lock);
+    bool done = reload_job.done;
+    pthread_mutex_unlock(&reload_job.lock);
+    if (!done) return false;
+
+    pthread_join(reload_job.thread, NULL);
+
+    if (at_prompt) printf("\n");
+    fflush(stdout);
+    error_log_flush(&reload_job.errors, stderr);
+
+    if (reload_job.result) {
+        Compiler_Context *old = active_compiler;
+        active_compiler = reload_job.result;
+        tier_inherit(active_compiler, old);
+        call_cache_clear();
+        cache_stats_publish(&active_compiler->cache);
+        jit_export_context(active_compiler, 0);
+#ifdef HAVE_READLINE
+        g_compiler_for_completion = active_compiler;
+#endif
+        compiler_destroy(old);
+        reload_count++;
+        printf("Reloaded %s in %.2f ms\n", reload_job.source_path, reload_job.elapsed_ms);
+        if (compile_stats_verbose) print_compile_stats(&active_compiler->stats);
+    } else {
+        printf("Reload failed after %.2f ms; still using the previous image\n",
+               reload_job.elapsed_ms);
+        if (reload_job.drop_library) library_drop_last();
+    }
+
+    reload_job_reset(&reload_job);
+    release_free_memory();
+    return true;
+}
+
+// Wait for an in-flight reload and discard its result (used on exit)
+static void reload_abandon(void) {
+    if (!reload_job.running) return;
+    pthread_join(reload_job.thread, NULL);
+    compiler_destroy(reload_job.result);
+    reload_job_reset(&reload_job);
+}
+
+// ============================================================================
+// Watch Mode
+// ============================================================================
+//
+// A watcher thread follows the source file and its local headers with
+// inotify. Editors often save by renaming a temp file over the original, so
+// the containing directories are watched and events are matched by name.
+// Once no matching event has arrived for WATCH_DEBOUNCE_MS the change is
+// flagged, and the main thread starts a background reload.
+
+#define WATCH_DEBOUNCE_MS 150
+#define WATCH_MAX_FILES 64
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_t thread;
+    bool active;
+    int inotify_fd;
+    int wake_pipe[2];               // Written to stop the watcher thread
+    char *source_path;
+    int encryption_mode;
+    char *files[WATCH_MAX_FILES];   // Watched files (source + local headers)
+    size_t file_count;
+    int wds[WATCH_MAX_FILES];       // inotify watch descriptor per directory
+    char *dirs[WATCH_MAX_FILES];
+    size_t dir_count;
+    bool change_pending;            // Debounced change waiting for a reload
+    char changed_file[4096];
+    unsigned changes;               // Changes picked up this session
+} Watch_State;
+
+static Watch_State watch = { .lock = PTHREAD_MUTEX_INITIALIZER, .inotify_fd = -1,
+                             .wake_pipe = {-1, -1} };
+
+static void watch_add_file(const char *path) {
+    if (watch.file_count >= WATCH_MAX_FILES) return;
+    watch.files[watch.file_count++] = strdup(path);
+
+    char dir[4096];
+    source_directory(path, dir, sizeof(dir));
+    if (!dir[0]) snprintf(dir, sizeof(dir), ".");
+
+    for (size_t i = 0; i < watch.dir_count; i++) {
+        if (strcmp(watch.dirs[i], dir) == 0) return;
+    }
+    int wd = inotify_add_watch(watch.inotify_fd, dir,
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    if (wd < 0) {
+        fprintf(stderr, "WARNING: Could not watch '%s': %s\n", dir, strerror(errno));
+        return;
+    }
+    watch.wds[watch.dir_count] = wd;
+    watch.dirs[watch.dir_count++] = strdup(dir);
+}
+
+static void watch_header_visitor(const char *path, const char *contents, void *ctx) {
+    (void)contents;
+    (void)ctx;
+    watch_add_file(path);
+}
+
+// Full path of a watched file matching an inotify event, or NULL
+static const char *watch_match_event(const struct inotify_event *event) {
+    if (event->len == 0) return NULL;
+    for (size_t i = 0; i < watch.dir_count; i++) {
+        if (watch.wds[i] != event->wd) continue;
+        for (size_t j = 0; j < watch.file_count; j++) {
+            char dir[4096];
+            source_directory(watch.files[j], dir, sizeof(dir));
+            if (!dir[0]) snprintf(dir, sizeof(dir), ".");
+            const char *base = strrchr(watch.files[j], '/');
+            base = base ? base + 1 : watch.files[j];
+            if (strcmp(dir, watch.dirs[i]) == 0 && strcmp(base, event->name) == 0) {
+                return watch.files[j];
+            }
+        }
+    }
+    return NULL;
+}
+
+static void *watch_worker(void *arg) {
+    (void)arg;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const char *dirty = NULL;
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = watch.inotify_fd, .events = POLLIN },
+            { .fd = watch.wake_pipe[0], .events = POLLIN },
+        };
+        int rc = poll(fds, 2, dirty ? WATCH_DEBOUNCE_MS : -1);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) break;
+
+        if (rc == 0) {
+            // Quiet for a full debounce window: hand the change to the REPL
+            pthread_mutex_lock(&watch.lock);
+            watch.change_pending = true;
+            snprintf(watch.changed_file, sizeof(watch.changed_file), "%s", dirty);
+            pthread_mutex_unlock(&watch.lock);
+            dirty = NULL;
+            continue;
+        }
+
+        ssize_t len = read(watch.inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0) continue;
+        for (char *p = buffer; p < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            const char *match = watch_match_event(event);
+            if (match) dirty = match;  // Restarts the debounce window
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return NULL;
+}
+
+static void watch_stop(void) {
+    if (!watch.active) return;
+
+    ssize_t written = write(watch.wake_pipe[1], "x", 1);
+    (void)written;
+    pthread_join(watch.thread, NULL);
+
+    close(watch.inotify_fd);
+    close(watch.wake_pipe[0]);
+    close(watch.wake_pipe[1]);
+    watch.inotify_fd = watch.wake_pipe[0] = watch.wake_pipe[1] = -1;
+
+    for (size_t i = 0; i < watch.file_count; i++) free(watch.files[i]);
+    for (size_t i = 0; i < watch.dir_count; i++) free(watch.dirs[i]);
+    watch.file_count = watch.dir_count = 0;
+    watch.active = false;
+}
+
+// Start watching source_path and the local headers of the active source
+static bool watch_start(const char *source_path, int encryption_mode) {
+    if (watch.active) return true;
+
+    if (is_url(source_path) || encryption_mode == 0) {
+        printf("ERROR: watch mode needs a local, unencrypted source file\n");
+        return false;
+    }
+
+    watch.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch.inotify_fd < 0) {
+        printf("ERROR: inotify unavailable: %s\n", strerror(errno));
+        return false;
+    }
+    if (pipe(watch.wake_pipe) != 0) {
+        close(watch.inotify_fd);
+        watch.inotify_fd = -1;
+        printf("ERROR: Could not create watch pipe\n");
+        return false;
+    }
+
+    if (watch.source_path != source_path) {
+        free(watch.source_path);
+        watch.source_path = strdup(source_path);
+    }
+    watch.encryption_mode = encryption_mode;
+
+    if (project_units.count > 0) {
+        for (size_t i = 0; i < project_units.count; i++) {
+            watch_add_file(project_units.items[i]);
+        }
+    } else {
+        watch_add_file(source_path);
+    }
+    char dir[4096];
+    source_directory(project_units.count > 0 ? project_units.items[0] : source_path,
+                     dir, sizeof(dir));
+    if (active_compiler && active_compiler->source_code) {
+        visit_local_includes(active_compiler->source_code, dir, watch_header_visitor, NULL);
+    }
+
+    sigset_t block, old_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &old_mask);
+    int rc = pthread_create(&watch.thread, NULL, watch_worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (rc != 0) {
+        watch.active = true;  // Let watch_stop() release the descriptors
+        watch_stop();
+        printf("ERROR: Could not start watch thread\n");
+        return false;
+    }
+
+    watch.active = true;
+    return true;
+}
+
+// Start a reload for a debounced change. Main thread only.
+static bool watch_poll(bool at_prompt) {
+    if (!watch.active || reload_job.running) return false;
+
+    pthread_mutex_lock(&watch.lock);
+    bool pending = watch.change_pending;
+    char changed[4096];
+    snprintf(changed, sizeof(changed), "%s", watch.changed_file);
+    watch.change_pending = false;
+    pthread_mutex_unlock(&watch.lock);
+    if (!pending) return false;
+
+    watch.changes++;
+    if (at_prompt) printf("\n");
+    printf("Change detected: %s\n", changed);
+    reload_start(watch.source_path, watch.encryption_mode);
+    return true;
+}
+
+// Handle finished reloads and pending watch changes. Main thread only.
+static bool repl_poll_events(bool at_prompt) {
+    bool printed = false;
+
+    if (reload_poll(at_prompt)) {
+        printed = true;
+        // The new source may include a different set of headers
+        if (watch.active) {
+            watch_stop();
+            watch_start(watch.source_path, watch.encryption_mode);
+        }
+    }
+    if (watch_poll(at_prompt && !printed)) printed = true;
+    return printed;
+}
+
+#ifdef HAVE_READLINE
+// Called by readline while it waits for input, so finished reloads and file
+// changes are handled immediately instead of on the next line
+static int repl_event_hook(void) {
+    if (repl_poll_events(true)) {
+        rl_on_new_line();
+        rl_redisplay();
+    }
+    return 0;
+}
+#endif
+
+// ============================================================================
+// Function Calls
+// ============================================================================
+
+// :time on - print the latency split of every interactive call
+static bool time_calls = false;
+
+// :rusage on - page faults, context switches and RSS growth of every call
+static bool rusage_calls = false;
+
+// :arena on - every call and :bench iteration allocates from the bump arena,
+// which is reset after it
+static bool arena_calls = false;
+
+// :counters on - hardware counters around every call and :bench run
+// (leader is -1 while off)
+static Perf_Group counters = { .leader = -1 };
+
+static void counters_enable(bool on) {
+    if (!on) {
+        perf_group_close(&counters);
+        printf("Hardware counters off\n");
+        return;
+    }
+    if (counters.leader >= 0) return;
+    char why[160];
+    if (!perf_group_open(&counters, why, sizeof(why))) {
+        printf("ERROR: Hardware counters unavailable: %s\n", why);
+        return;
+    }
+    printf("Hardware counters on:");
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (counters.fd[i] >= 0) printf(" %s", perf_counter_names[i]);
+    }
+    printf("\n");
+}
+
+// Link the allocator hooks into the image, or drop them, when :allocs or
+// :arena changed whether they are needed. False if the rebuild didn't start.
+static bool alloc_hooks_update(const char *source_path, int encryption_mode) {
+    bool wanted = alloc_counting || arena_calls;
+    if (wanted == alloc_hooks) return true;
+    if (reload_job.running) {
+        printf("ERROR: wait for the running reload to finish\n");
+        return false;
+    }
+    alloc_hooks = wanted;
+    if (reload_start(source_path, encryption_mode)) return true;
+    alloc_hooks = !wanted;
+    return false;
+}
+
+// Parse "fn args..." and resolve its call site (cached after the first call
+// with these argument types). Prints the error and returns NULL on failure.
+static Call_Site *prepare_call(Compiler_Context *compiler, String_View call,
+                               Type_Array *types, Value_Array *values) {
+    // A token never takes more room unescaped than in the source, so storage
+    // the size of the input holds all string arguments at once
+    if (call.count > INT_MAX - 2) {
+        printf("ERROR: input too long\n");
+        return NULL;
+    }
+    char *string_store = temp_alloc(call.count + 2);
+    if (!string_store) return NULL;
+    stb_lexer lexer;
+    stb_c_lexer_init(&lexer, call.data, call.data + call.count,
+                     string_store, (int)call.count + 2);
+
+    if (!stb_c_lexer_get_token(&lexer)) return NULL;
+
+    if (lexer.token != CLEX_id) {
+        printf("ERROR: function name must be an identifier\n");
+        return NULL;
+    }
+
+    // Save function name (lexer.string gets overwritten during parse_arguments)
+    char function_name[256];
+    strncpy(function_name, lexer.string, sizeof(function_name) - 1);
+    function_name[sizeof(function_name) - 1] = '\0';
+
+    // Parse arguments (their types are part of the call-site key):
+    // declared parameter types when the signature is understood
+    Symbol_Info *symbol = symbol_index_find(compiler, function_name);
+    if (symbol && symbol->plan.known) {
+        if (!marshal_arguments(&lexer, function_name, &symbol->plan, types, values)) return NULL;
+    } else if (!parse_arguments(&lexer, types, values)) {
+        return NULL;
+    }
+
+    Call_Site *site = call_cache_lookup(function_name, types->items, types->count);
+    if (site) {
+        if (site->stub_pending) {
+            site->stub = stub_for(site->return_type, site->arg_types, site->arg_count,
+                                  &site->stub_pending);
+        }
+        return site;
+    }
+
+    // Look up function
+    void *func_ptr = compiler_get_symbol(compiler, function_name);
+    if (!func_ptr) {
+        printf("ERROR: function '%s' not found\n", function_name);
+        printf("Hint: Make sure the function is defined and not static\n");
+        return NULL;
+    }
+
+    // Promoted functions run from the optimized image, except while the
+    // allocator hooks are linked: gcc's image calls the C library directly
+    Tier_Entry *tier = tier_lookup(compiler, function_name);
+    if (tier->optimized && !compiler->alloc_hooked) func_ptr = tier->optimized;
+
+    // Detect return type from the indexed signature (libraries: source text)
+    ffi_type *return_type = detect_return_type(function_name,
+        symbol && symbol->signature ? symbol->signature
+                                    : compiler_source_for(compiler, function_name));
+
+    ffi_status status;
+    site = call_cache_insert(function_name, types->items, types->count, return_type,
+                             func_ptr, (size_t)(tier - compiler->tier.items), &status);
+    if (!site) {
+        printf("ERROR: could not prepare FFI call (status: %d)\n", status);
+        return NULL;
+    }
+    site->stub = stub_for(return_type, types->items, types->count, &site->stub_pending);
+    return site;
+}
+
+// Zeroed return value storage for site (NULL for void). ffi_call() widens
+// small integer results to a full ffi_arg.
+static void *call_result_buffer(const Call_Site *site) {
+    if (site->return_type == &ffi_type_void) return NULL;
+    size_t size = site->return_type->size;
+    if (size < sizeof(ffi_arg)) size = sizeof(ffi_arg);
+    void *result = temp_alloc(size);
+    if (result) memset(result, 0, size);
+    return result;
+}
+
+static inline void call_site_invoke(const Call_Site *site, void **values, void *result) {
+    if (site->stub) {
+        site->stub(site->func, values, result);
+    } else {
+        ffi_call((ffi_cif *)&site->cif, (void(*)())site->func, result, values);
+    }
+}
+
+// ============================================================================
+// Benchmarking
+// ============================================================================
+//
+// :bench [-n N] [-w W] fn args... parses and resolves the call once, runs it
+// W times untimed and then N times timed one by one with the raw monotonic
+// clock, through the same call site as an interactive call. Bench runs don't
+// count toward tier promotion, so the code being measured can't change
+// halfway through.
+
+#define BENCH_DEFAULT_ITERATIONS 10000
+#define BENCH_DEFAULT_WARMUP 100
+#define BENCH_MAX_ITERATIONS 100000000UL
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// p-th percentile of sorted samples (nearest rank below)
+static double percentile(const uint64_t *samples, size_t count, unsigned p) {
+    return (double)samples[(count - 1) * p / 100];
+}
+
+// "1.23 µs" and the like
+static const char *format_ns(double ns, char *buffer, size_t size) {
+    if (ns < 1e3) snprintf(buffer, size, "%.0f ns", ns);
+    else if (ns < 1e6) snprintf(buffer, size, "%.2f µs", ns / 1e3);
+    else if (ns < 1e9) snprintf(buffer, size, "%.2f ms", ns / 1e6);
+    else snprintf(buffer, size, "%.2f s", ns / 1e9);
+    return buffer;
+}
+
+// Native mode (--native): for functions that take nanoseconds, the dispatch
+// above is most of what gets measured. A C harness is generated instead that
+// calls the target directly (linked with tcc_add_symbol()) in a loop with the
+// arguments baked in as constants, storing each result into a volatile sink
+// so the call can't be dropped. An identical loop without the call is timed
+// too and subtracted. The harness is always compiled with TCC, since its
+// target lives only in this process; a promoted function is still measured
+// in its optimized code.
+
+#define BENCH_NATIVE_ITERATIONS 1000000
+#define BENCH_NATIVE_ROUNDS 5
+
+typedef uint64_t (*Bench_Harness)(uint64_t (*clock)(void), unsigned long n, uint64_t *loop_ns);
+
+static uint64_t bench_clock(void) {
+    return now_ns();
+}
+
+// C literal for one marshalled argument value
+static bool bench_c_literal(ffi_type *type, const void *value, char *out, size_t size) {
+    const char *ctype = stub_c_type(type);
+    if (!ctype) return false;
+
+    if (type == &ffi_type_double || type == &ffi_type_float) {
+        double d = type == &ffi_type_double ? *(const double *)value : *(const float *)value;
+        if (!isfinite(d)) return false;
+        snprintf(out, size, "(%s)%.17g", ctype, d);
+    } else if (type == &ffi_type_pointer) {
+        snprintf(out, size, "(void *)%lluULL",
+                 (unsigned long long)(uintptr_t)*(void *const *)value);
+    } else {
+        unsigned long long bits = 0;
+        bool is_signed = type->type == FFI_TYPE_SINT8 || type->type == FFI_TYPE_SINT16 ||
+                         type->type == FFI_TYPE_SINT32 || type->type == FFI_TYPE_SINT64;
+        switch (type->size) {
+            case 1: bits = is_signed ? (unsigned long long)*(const int8_t *)value : *(const uint8_t *)value; break;
+            case 2: bits = is_signed ? (unsigned long long)*(const int16_t *)value : *(const uint16_t *)value; break;
+            case 4: bits = is_signed ? (unsigned long long)*(const int32_t *)value : *(const uint32_t *)value; break;
+            default: bits = *(const uint64_t *)value; break;
+        }
+        snprintf(out, size, "(%s)%lluULL", ctype, bits);
+    }
+    return true;
+}
+
+// Append to the harness source. False once it no longer fits; used then
+// stays past the end, so every later append fails as well.
+static bool bench_append(char *source, size_t size, size_t *used, const char *format, ...) {
+    if (*used >= size) return false;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(source + *used, size - *used, format, args);
+    va_end(args);
+    *used += n < 0 ? size : (size_t)n;
+    return *used < size;
+}
+
+static Bench_Harness bench_native_build(const Call_Site *site, void **values, TCCState **state) {
+    char source[8192];
+    size_t used = 0;
+    const char *rtype = stub_c_type(site->return_type);
+    bool is_void = site->return_type == &ffi_type_void;
+
+    bench_append(source, sizeof(source), &used, "%s malcrepl_target(", rtype);
+    for (unsigned i = 0; i < site->arg_count; i++) {
+        bench_append(source, sizeof(source), &used, "%s%s",
+                     i ? ", " : "", stub_c_type(site->arg_types[i]));
+    }
+    bench_append(source, sizeof(source), &used, "%s);\n", site->arg_count ? "" : "void");
+    if (!is_void) {
+        bench_append(source, sizeof(source), &used,
+                     "%s volatile malcrepl_sink;\n%s volatile malcrepl_source;\n",
+                     rtype, rtype);
+    }
+    bench_append(source, sizeof(source), &used,
+                 "unsigned long long malcrepl_bench(unsigned long long (*clock)(void),\n"
+                 "                                  unsigned long n, unsigned long long *loop_ns) {\n"
+                 "    unsigned long long start = clock();\n"
+                 "    for (unsigned long i = 0; i < n; i++) %smalcrepl_target(",
+                 is_void ? "" : "malcrepl_sink = ");
+    for (unsigned i = 0; i < site->arg_count; i++) {
+        char literal[64];
+        if (!bench_c_literal(site->arg_types[i], values[i], literal, sizeof(literal))) {
+            printf("ERROR: argument %u can't be embedded in a native harness\n", i + 1);
+            return NULL;
+        }
+        bench_append(source, sizeof(source), &used, "%s%s", i ? ", " : "", literal);
+    }
+    bool fits = bench_append(source, sizeof(source), &used,
+                             ");\n"
+                             "    unsigned long long middle = clock();\n"
+                             "    for (unsigned long i = 0; i < n; i++) %s;\n"
+                             "    *loop_ns = clock() - middle;\n"
+                             "    return middle - start;\n"
+                             "}\n",
+                             is_void ? "{}" : "malcrepl_sink = malcrepl_source");
+    if (!fits) {
+        printf("ERROR: %s has too many arguments for a native harness\n", site->name);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&tcc_lock);
+    Bench_Harness harness = NULL;
+    *state = tcc_new_state();
+    if (*state) {
+        tcc_set_output_type(*state, TCC_OUTPUT_MEMORY);
+        tcc_add_symbol(*state, "malcrepl_target", site->func);
+        if (tcc_compile_string(*state, source) == 0 &&
+            tcc_relocate(*state, TCC_RELOCATE_AUTO) >= 0) {
+            harness = (Bench_Harness)tcc_get_symbol(*state, "malcrepl_bench");
+        }
+        if (!harness) {
+            tcc_delete(*state);
+            *state = NULL;
+        }
+    }
+    pthread_mutex_unlock(&tcc_lock);
+    if (!harness) {
+        printf("ERROR: Could not compile the benchmark harness\n");
+        return NULL;
+    }
+
+    if (jit_export_enabled()) {
+        char name[256];
+        snprintf(name, sizeof(name), "malcrepl_bench[%s]", site->name);
+        jit_export_code((void *)harness, tcc_code_size((void *)harness, 0), name);
+    }
+    return harness;
+}
+
+static void bench_native(const Call_Site *site, void **values,
+                         unsigned long iterations, unsigned long warmup) {
+    if (!stub_c_type(site->return_type)) {
+        printf("ERROR: return type of %s isn't supported in native mode\n", site->name);
+        return;
+    }
+    TCCState *state = NULL;
+    Bench_Harness harness = bench_native_build(site, values, &state);
+    if (!harness) return;
+
+    uint64_t loop_ns;
+    if (warmup > 0) harness(bench_clock, warmup, &loop_ns);
+
+    Resource_Usage usage_before, usage_after;
+    resource_usage_now(&usage_before);
+    double per_call[BENCH_NATIVE_ROUNDS], loop_per_iter = 0.0;
+    for (int r = 0; r < BENCH_NATIVE_ROUNDS; r++) {
+        uint64_t call_ns = harness(bench_clock, iterations, &loop_ns);
+        double loop = (double)loop_ns / (double)iterations;
+        per_call[r] = (double)call_ns / (double)iterations - loop;
+        if (per_call[r] < 0.0) per_call[r] = 0.0;
+        loop_per_iter += loop / BENCH_NATIVE_ROUNDS;
+    }
+    resource_usage_now(&usage_after);
+
+    // Rounds are few, so insertion sort
+    for (int i = 1; i < BENCH_NATIVE_ROUNDS; i++) {
+        for (int j = i; j > 0 && per_call[j] < per_call[j - 1]; j--) {
+            double t = per_call[j];
+            per_call[j] = per_call[j - 1];
+            per_call[j - 1] = t;
+        }
+    }
+
+    char a[32], b[32], c[32];
+    printf("\n%s (native): %d round(s) of %lu call(s) after %lu warmup\n",
+           site->name, BENCH_NATIVE_ROUNDS, iterations, warmup);
+    printf("  per call: best %.2f ns  median %s  worst %s  (loop overhead %s subtracted)\n",
+           per_call[0], format_ns(per_call[BENCH_NATIVE_ROUNDS / 2], a, sizeof(a)),
+           format_ns(per_call[BENCH_NATIVE_ROUNDS - 1], b, sizeof(b)),
+           format_ns(loop_per_iter, c, sizeof(c)));
+    print_resource_usage(&usage_before, &usage_after,
+                         (double)iterations * BENCH_NATIVE_ROUNDS);
+    printf("\n");
+
+    pthread_mutex_lock(&tcc_lock);
+    tcc_delete(state);
+    pthread_mutex_unlock(&tcc_lock);
+}
+
+typedef struct {
+    unsigned long iterations;   // 0 = the mode's default
+    unsigned long warmup;
+    bool native;
+} Bench_Options;
+
+// Parse "-n N", "-w W" and "--native" off the front of args. Returns false
+// on a bad value.
+static bool bench_parse_options(String_View *args, Bench_Options *options) {
+    for (;;) {
+        String_View value;
+        unsigned long *target;
+        if (sv_chop_prefix(*args, "--native", args)) {
+            options->native = true;
+            continue;
+        }
+        if (sv_chop_prefix(*args, "-n", &value)) target = &options->iterations;
+        else if (sv_chop_prefix(*args, "-w", &value)) target = &options->warmup;
+        else return true;
+
+        // The view ends where the input line does, so strtoul() stays inside it
+        char *end;
+        errno = 0;
+        unsigned long n = strtoul(value.data, &end, 10);
+        if (end == value.data || errno != 0 || value.data[0] == '-') {
+            printf("ERROR: %.2s needs a number\n", args->data);
+            return false;
+        }
+        *target = n;
+        *args = sv_trim((String_View){ end, value.count - (size_t)(end - value.data) });
+    }
+}
+
+static void bench_run(Compiler_Context *compiler, String_View args,
+                      Type_Array *types, Value_Array *values) {
+    Bench_Options options = { .warmup = BENCH_DEFAULT_WARMUP };
+    if (!bench_parse_options(&args, &options)) return;
+    if (args.count == 0) {
+        printf("Usage: :bench [--native] [-n N] [-w W] fn args...\n");
+        return;
+    }
+    unsigned long iterations = options.iterations, warmup = options.warmup;
+    if (iterations == 0) {
+        iterations = options.native ? BENCH_NATIVE_ITERATIONS : BENCH_DEFAULT_ITERATIONS;
+    }
+    if (iterations > BENCH_MAX_ITERATIONS) {
+        printf("ERROR: -n must be at most %lu\n", BENCH_MAX_ITERATIONS);
+        return;
+    }
+
+    Call_Site *site = prepare_call(compiler, args, types, values);
+    if (!site) return;
+    if (options.native) {
+        if (counters.leader >= 0) printf("(Hardware counters aren't collected in native mode)\n");
+        bench_native(site, values->items, iterations, warmup);
+        return;
+    }
+    void *result = call_result_buffer(site);
+    if (!result && site->return_type != &ffi_type_void) {
+        printf("ERROR: Could not allocate memory for return value\n");
+        return;
+    }
+    uint64_t *samples = malloc(iterations * sizeof(uint64_t));
+    if (!samples) {
+        printf("ERROR: Could not allocate %lu samples\n", iterations);
+        return;
+    }
+
+    // Each iteration starts on an empty arena, like an interactive call
+    bool arena = compiler->alloc_hooked && arena_calls;
+    if (arena) alloc_backend = ALLOC_BACKEND_BUMP;
+    for (unsigned long i = 0; i < warmup; i++) {
+        call_site_invoke(site, values->items, result);
+        if (arena) bump_arena_reset();
+    }
+
+    Perf_Sample sample;
+    bool counted = false;
+    Resource_Usage usage_before, usage_after;
+    Alloc_Stats allocs;
+    bool track_allocs = compiler->alloc_hooked && alloc_counting;
+    resource_usage_now(&usage_before);
+    if (track_allocs) alloc_window_begin();
+    if (counters.leader >= 0) perf_group_start(&counters);
+    uint64_t run_start = now_ns();
+    for (unsigned long i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+        call_site_invoke(site, values->items, result);
+        samples[i] = now_ns() - start;
+        if (arena) bump_arena_reset();
+    }
+    uint64_t run_ns = now_ns() - run_start;
+    if (counters.leader >= 0) counted = perf_group_stop(&counters, &sample);
+    if (track_allocs) alloc_window_end(&allocs);
+    alloc_backend = ALLOC_BACKEND_LIBC;
+    resource_usage_now(&usage_after);
+
+    // Back-to-back clock reads: the floor every sample includes
+    uint64_t timer_ns = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t t = now_ns();
+        uint64_t d = now_ns() - t;
+        if (d < timer_ns) timer_ns = d;
+    }
+
+    double mean = 0.0, m2 = 0.0;
+    for (unsigned long i = 0; i < iterations; i++) {
+        double delta = (double)samples[i] - mean;
+        mean += delta / (double)(i + 1);
+        m2 += delta * ((double)samples[i] - mean);
+    }
+    double stddev = iterations > 1 ? sqrt(m2 / (double)(iterations - 1)) : 0.0;
+
+    qsort(samples, iterations, sizeof(uint64_t), compare_u64);
+
+    char a[32], b[32], c[32], d[32], e[32];
+    printf("\n%s: %lu call(s) after %lu warmup\n", site->name, iterations, warmup);
+    printf("  min %s  median %s  p90 %s  p99 %s  max %s\n",
+           format_ns((double)samples[0], a, sizeof(a)),
+           format_ns(percentile(samples, iterations, 50), b, sizeof(b)),
+           format_ns(percentile(samples, iterations, 90), c, sizeof(c)),
+           format_ns(percentile(samples, iterations, 99), d, sizeof(d)),
+           format_ns((double)samples[iterations - 1], e, sizeof(e)));
+    printf("  mean %s ± %s  %.0f calls/s  (clock read ~%s, %s)\n",
+           format_ns(mean, a, sizeof(a)), format_ns(stddev, b, sizeof(b)),
+           run_ns ? (double)iterations * 1e9 / (double)run_ns : 0.0,
+           format_ns((double)timer_ns, c, sizeof(c)),
+           site->stub ? "direct stub" : "ffi_call");
+    if (counted) perf_sample_print(&sample, (double)iterations);
+    print_resource_usage(&usage_before, &usage_after, (double)iterations);
+    if (track_allocs) alloc_stats_print(&allocs, (double)iterations);
+    if (arena) bump_arena_print();
+    display_return_value(site->return_type, result, "");
+    printf("\n");
+    free(samples);
+}
+
+// ============================================================================
+// Sampling Profiler
+// ============================================================================
+//
+// :profile [-n N] [--wall] [--folded file] fn args... calls fn repeatedly
+// (N times, or for about a second) while a timer raises SIGPROF on this
+// thread. The timer runs on the thread's CPU clock, so it only fires while
+// fn computes and only on the kernel tick; --wall switches to the monotonic
+// clock, which samples every 100 µs but also interrupts fn's blocking calls
+// (EINTR). The handler records the interrupted PC and walks
+// the frame-pointer chain (TCC always keeps frame pointers) within the
+// thread's stack. Afterwards each address is mapped to a function: dladdr()
+// for shared objects (cached and optimized images, libraries), the symbol
+// index's addresses and sizes for TCC's anonymous memory. Stacks are cut
+// below the outermost frame of fn; samples outside it are the REPL's own
+// dispatch and show up as [repl].
+
+#define PROFILE_INTERVAL_NS 100000
+#define PROFILE_DEFAULT_MS 1000
+#define PROFILE_MAX_SAMPLES 50000
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_UNSIZED_SPAN 65536  // Reach of a function whose size is unknown
+
+#if defined(__x86_64__)
+#define PROFILE_PC(uc) ((uintptr_t)(uc)->uc_mcontext.gregs[REG_RIP])
+#define PROFILE_FP(uc) ((uintptr_t)(uc)->uc_mcontext.gregs[REG_RBP])
+#elif defined(__aarch64__)
+#define PROFILE_PC(uc) ((uintptr_t)(uc)->uc_mcontext.pc)
+#define PROFILE_FP(uc) ((uintptr_t)(uc)->uc_mcontext.regs[29])
+#endif
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+typedef struct {
+    uintptr_t pc[PROFILE_MAX_DEPTH];    // Leaf first
+    unsigned depth;
+} Profile_Sample;
+
+// Written only by the SIGPROF handler on the profiled thread
+static Profile_Sample *profile_samples;
+static volatile size_t profile_count;
+static volatile size_t profile_dropped;
+static uintptr_t profile_stack_low, profile_stack_high;
+
+#ifdef PROFILE_PC
+static void profile_signal_handler(int sig, siginfo_t *info, void *context) {
+    (void)sig;
+    (void)info;
+    if (profile_count >= PROFILE_MAX_SAMPLES) {
+        profile_dropped++;
+        return;
+    }
+    ucontext_t *uc = context;
+    Profile_Sample *sample = &profile_samples[profile_count];
+    sample->pc[0] = PROFILE_PC(uc);
+    unsigned depth = 1;
+
+    // Each frame record is { previous frame pointer, return address }
+    uintptr_t fp = PROFILE_FP(uc);
+    while (depth < PROFILE_MAX_DEPTH && (fp & 7) == 0 &&
+           fp >= profile_stack_low && fp + 2 * sizeof(uintptr_t) <= profile_stack_high) {
+        uintptr_t next = ((uintptr_t *)fp)[0];
+        uintptr_t ret = ((uintptr_t *)fp)[1];
+        if (!ret) break;
+        sample->pc[depth++] = ret - 1;  // Inside the call instruction
+        if (next <= fp) break;
+        fp = next;
+    }
+    sample->depth = depth;
+    profile_count++;
+}
+#endif
+
+typedef struct {
+    const char *name;
+    uintptr_t addr;
+    size_t size;
+} Profile_Symbol;
+
+typedef struct {
+    Profile_Symbol *items;      // Functions in anonymous memory, by address
+    size_t count;
+    size_t capacity;
+    String_Array names;         // Names made up for library frames
+} Profile_Symbols;
+
+static int compare_profile_symbol(const void *a, const void *b) {
+    const Profile_Symbol *x = a, *y = b;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+// Function containing pc
+static const char *profile_symbolize(Profile_Symbols *symbols, uintptr_t pc) {
+    Dl_info info;
+    if (dladdr((void *)pc, &info) && info.dli_fname) {
+        if (info.dli_sname) return info.dli_sname;
+        const char *base = strrchr(info.dli_fname, '/');
+        char name[256];
+        snprintf(name, sizeof(name), "[%s]", base ? base + 1 : info.dli_fname);
+        for (size_t i = 0; i < symbols->names.count; i++) {
+            if (strcmp(symbols->names.items[i], name) == 0) return symbols->names.items[i];
+        }
+        da_append(&symbols->names, strdup(name));
+        return symbols->names.items[symbols->names.count - 1];
+    }
+
+    // Greatest address <= pc
+    size_t lo = 0, hi = symbols->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (symbols->items[mid].addr <= pc) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo > 0) {
+        const Profile_Symbol *sym = &symbols->items[lo - 1];
+        size_t span = sym->size ? sym->size : PROFILE_UNSIZED_SPAN;
+        if (pc - sym->addr < span) return sym->name;
+    }
+    return "[unknown]";
+}
+
+typedef struct {
     const char *name;
-    while ((name = commands[list_index++])) {
-        if (strncmp(name, text, len) == 0) {
-            return strdup(name);
+    size_t self;
+    size_t total;
+    size_t seen_at;             // Last sample counted in total, plus one
+} Profile_Entry;
+
+typedef struct {
+    Profile_Entry *items;
+    size_t count;
+    size_t capacity;
+} Profile_Table;
+
+static Profile_Entry *profile_entry(Profile_Table *table, const char *name) {
+    for (size_t i = 0; i < table->count; i++) {
+        if (table->items[i].name == name || strcmp(table->items[i].name, name) == 0) {
+            return &table->items[i];
         }
     }
-    return NULL;
+    Profile_Entry entry = { .name = name };
+    da_append(table, entry);
+    return &table->items[table->count - 1];
 }
 
-// Extract all function names from source code
-static char **get_function_names(Compiler_Context *compiler, size_t *count) {
-    if (!compiler || !compiler->source_code) {
-        *count = 0;
-        return NULL;
+static int compare_profile_entry(const void *a, const void *b) {
+    const Profile_Entry *x = a, *y = b;
+    if (x->self != y->self) return x->self < y->self ? 1 : -1;
+    return x->total < y->total ? 1 : x->total > y->total ? -1 : 0;
+}
+
+static int compare_cstr(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Symbolize the recorded samples; prints the flat profile and writes folded
+// stacks ("outer;inner;leaf count" per line) when folded_path is set
+static void profile_report(Compiler_Context *compiler, const Call_Site *site,
+                           unsigned long calls, bool wall_clock, const char *folded_path) {
+    Profile_Symbols symbols = {0};
+    if (!compiler->symbols.built) symbol_index_build(compiler);
+    for (size_t i = 0; i < compiler->symbols.count; i++) {
+        const Symbol_Info *info = &compiler->symbols.items[i];
+        if (!info->is_function) continue;
+        Profile_Symbol sym = { info->name, (uintptr_t)info->addr, info->size };
+        da_append(&symbols, sym);
     }
-    
-    // Initial allocation
-    size_t capacity = 32;
-    char **names = malloc(capacity * sizeof(char*));
-    if (!names) {
-        *count = 0;
-        return NULL;
+    qsort(symbols.items, symbols.count, sizeof(Profile_Symbol), compare_profile_symbol);
+
+    Dl_info repl_info = {0};
+    dladdr((void *)profile_report, &repl_info);
+
+    Profile_Table table = {0};
+    FILE *folded = NULL;
+    char **stacks = NULL;
+    if (folded_path) {
+        folded = fopen(folded_path, "w");
+        if (!folded) printf("ERROR: Could not write '%s': %s\n", folded_path, strerror(errno));
+        else stacks = calloc(profile_count ? profile_count : 1, sizeof(char *));
     }
-    
-    *count = 0;
-    
-    // Parse source code to find function definitions
-    const char *p = compiler->source_code;
-    char current_func[256];
-    
-    while (*p) {
-        // Skip whitespace
-        while (*p && isspace((unsigned char)*p)) p++;
-        
-        // Look for identifier followed by '('
-        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || *p == '_') {
-            const char *word_start = p;
-            
-            // Read identifier
-            while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || 
-                   (*p >= '0' && *p <= '9') || *p == '_') {
-                p++;
-            }
-            
-            // Skip whitespace
-            const char *after_id = p;
-            while (*p && isspace((unsigned char)*p)) p++;
-            
-            // Check if this is a function (followed by '(')
-            if (*p == '(') {
-                size_t name_len = after_id - word_start;
-                
-                if (name_len > 0 && name_len < sizeof(current_func)) {
-                    memcpy(current_func, word_start, name_len);
-                    current_func[name_len] = '\0';
-                    
-                    // Check if it's actually callable
-                    void *func_ptr = compiler_get_symbol(compiler, current_func);
-                    if (func_ptr) {
-                        // Check if already in list (avoid duplicates)
-                        int duplicate = 0;
-                        for (size_t i = 0; i < *count; i++) {
-                            if (strcmp(names[i], current_func) == 0) {
-                                duplicate = 1;
-                                break;
-                            }
-                        }
-                        
-                        if (!duplicate) {
-                            // Expand array if needed
-                            if (*count >= capacity) {
-                                capacity *= 2;
-                                char **new_names = realloc(names, capacity * sizeof(char*));
-                                if (!new_names) {
-                                    // Cleanup on error
-                                    for (size_t i = 0; i < *count; i++) {
-                                        free(names[i]);
-                                    }
-                                    free(names);
-                                    *count = 0;
-                                    return NULL;
-                                }
-                                names = new_names;
-                            }
-                            
-                            names[*count] = strdup(current_func);
-                            if (names[*count]) {
-                                (*count)++;
-                            }
-                        }
-                    }
-                }
+
+    for (size_t s = 0; s < profile_count; s++) {
+        const Profile_Sample *sample = &profile_samples[s];
+        const char *frames[PROFILE_MAX_DEPTH];
+        unsigned depth = 0, cut = 0;
+        for (unsigned d = 0; d < sample->depth; d++) {
+            frames[depth] = profile_symbolize(&symbols, sample->pc[d]);
+            if (strcmp(frames[depth], site->name) == 0) cut = depth + 1;
+            depth++;
+        }
+        if (cut == 0) {
+            // Outside fn's frames: the REPL's own code, or a leaf fn reached
+            // without a frame of its own (prologue, frameless callee)
+            Dl_info info;
+            if (dladdr((void *)sample->pc[0], &info) && info.dli_fbase == repl_info.dli_fbase) {
+                frames[0] = "[repl]";
             }
-        } else {
-            p++;
+            cut = 1;
         }
-    }
-    
-    return names;
-}
 
-// Function name completion generator
-static char *function_generator(const char *text, int state) {
-    static char **function_names = NULL;
-    static size_t function_count = 0;
-    static size_t list_index;
-    static size_t len;
-    
-    // Initialize on first call
-    if (!state) {
-        // Free previous list if it exists
-        if (function_names) {
-            for (size_t i = 0; i < function_count; i++) {
-                free(function_names[i]);
+        profile_entry(&table, frames[0])->self++;
+        for (unsigned d = 0; d < cut; d++) {
+            Profile_Entry *entry = profile_entry(&table, frames[d]);
+            if (entry->seen_at != s + 1) {
+                entry->seen_at = s + 1;
+                entry->total++;
             }
-            free(function_names);
-            function_names = NULL;
         }
-        
-        // Get fresh function list
-        if (g_compiler_for_completion) {
-            function_names = get_function_names(g_compiler_for_completion, &function_count);
+
+        if (stacks) {
+            size_t len = 1;
+            for (unsigned d = 0; d < cut; d++) len += strlen(frames[d]) + 1;
+            char *line = malloc(len);
+            if (line) {
+                size_t used = 0;
+                for (unsigned d = cut; d-- > 0;) {
+                    used += snprintf(line + used, len - used, "%s%s", frames[d], d ? ";" : "");
+                }
+            }
+            stacks[s] = line;
         }
-        
-        list_index = 0;
-        len = strlen(text);
     }
-    
-    // Return matching functions
-    while (list_index < function_count) {
-        const char *name = function_names[list_index++];
-        if (strncmp(name, text, len) == 0) {
-            return strdup(name);
-        }
+
+    size_t total = profile_count;
+    if (wall_clock) {
+        printf("\nProfile of %s: %zu sample(s) every %d µs over %lu call(s)",
+               site->name, total, PROFILE_INTERVAL_NS / 1000, calls);
+    } else {
+        printf("\nProfile of %s: %zu sample(s) of CPU time over %lu call(s)",
+               site->name, total, calls);
     }
-    
-    // Cleanup when done
-    if (function_names) {
-        for (size_t i = 0; i < function_count; i++) {
-            free(function_names[i]);
+    if (profile_dropped) printf(", %zu dropped", (size_t)profile_dropped);
+    printf("\n");
+    if (total == 0) {
+        printf("  No samples; run more calls with -n\n\n");
+    } else {
+        qsort(table.items, table.count, sizeof(Profile_Entry), compare_profile_entry);
+        printf("   self   total  function\n");
+        for (size_t i = 0; i < table.count && i < 20; i++) {
+            printf("  %5.1f%%  %5.1f%%  %s\n",
+                   100.0 * table.items[i].self / total,
+                   100.0 * table.items[i].total / total, table.items[i].name);
         }
-        free(function_names);
-        function_names = NULL;
-        function_count = 0;
+        printf("\n");
     }
-    
-    return NULL;
-}
 
-// Combined completion: commands + functions
-static char *combined_generator(const char *text, int state) {
-    static int phase = 0;  // 0 = commands, 1 = functions
-    
-    if (!state) {
-        phase = 0;
-    }
-    
-    // Try commands first
-    if (phase == 0) {
-        char *result = command_generator(text, state);
-        if (result) {
-            return result;
+    if (stacks) {
+        qsort(stacks, total, sizeof(char *), compare_cstr);
+        for (size_t i = 0; i < total;) {
+            size_t j = i + 1;
+            while (j < total && stacks[i] && stacks[j] && strcmp(stacks[i], stacks[j]) == 0) j++;
+            if (stacks[i]) fprintf(folded, "%s %zu\n", stacks[i], j - i);
+            i = j;
         }
-        // Commands exhausted, move to functions
-        phase = 1;
-        state = 0;  // Reset state for function generator
+        for (size_t i = 0; i < total; i++) free(stacks[i]);
+        free(stacks);
+        printf("Folded stacks written to %s\n\n", folded_path);
     }
-    
-    // Try functions
-    return function_generator(text, state);
+    if (folded) fclose(folded);
+
+    da_free(&table);
+    da_free(&symbols);
+    string_array_free(&symbols.names);
 }
 
-// Completion function
-static char **repl_command_completion(const char *text, int start, int end) {
-    (void)end;
-    
-    // Always try completion at start of line
-    if (start == 0) {
-        // If text starts with ':', complete commands only
-        if (text[0] == ':') {
-            return rl_completion_matches(text, command_generator);
+static void profile_run(Compiler_Context *compiler, String_View args,
+                        Type_Array *types, Value_Array *values) {
+#ifndef PROFILE_PC
+    (void)compiler; (void)args; (void)types; (void)values;
+    printf("ERROR: :profile isn't supported on this architecture\n");
+#else
+    unsigned long iterations = 0;
+    bool wall_clock = false;
+    char folded_path[PATH_MAX] = "";
+    for (;;) {
+        String_View value;
+        if (sv_chop_prefix(args, "--wall", &value)) {
+            wall_clock = true;
+            args = value;
+        } else if (sv_chop_prefix(args, "--folded", &value)) {
+            size_t len = 0;
+            while (len < value.count && !isspace((unsigned char)value.data[len])) len++;
+            if (len == 0 || len >= sizeof(folded_path)) {
+                printf("ERROR: --folded needs a file name\n");
+                return;
+            }
+            snprintf(folded_path, sizeof(folded_path), "%.*s", (int)len, value.data);
+            args = sv_trim((String_View){ value.data + len, value.count - len });
+        } else if (sv_chop_prefix(args, "-n", &value)) {
+            char *end;
+            errno = 0;
+            iterations = strtoul(value.data, &end, 10);
+            if (end == value.data || errno != 0 || value.data[0] == '-') {
+                printf("ERROR: -n needs a number\n");
+                return;
+            }
+            args = sv_trim((String_View){ end, value.count - (size_t)(end - value.data) });
+        } else {
+            break;
         }
-        // Otherwise complete both commands and functions
-        return rl_completion_matches(text, combined_generator);
     }
-    
-    // Suppress default filename completion
-    rl_attempted_completion_over = 1;
-    return NULL;
-}
+    if (args.count == 0) {
+        printf("Usage: :profile [-n N] [--wall] [--folded file] fn args...\n");
+        return;
+    }
 
-// Setup completion
-static void setup_readline_completion(Compiler_Context *compiler) {
-    // Store compiler context globally for completion
-    g_compiler_for_completion = compiler;
-    
-    // Set our custom completion function
-    rl_attempted_completion_function = repl_command_completion;
-}
+    Call_Site *site = prepare_call(compiler, args, types, values);
+    if (!site) return;
+    void *result = call_result_buffer(site);
+    if (!result && site->return_type != &ffi_type_void) {
+        printf("ERROR: Could not allocate memory for return value\n");
+        return;
+    }
 
-#endif // HAVE_READLINE
+    // Frame pointers outside this thread's stack are never followed
+    pthread_attr_t attr;
+    void *stack_addr;
+    size_t stack_size;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+        printf("ERROR: Could not locate the thread's stack\n");
+        return;
+    }
+    pthread_attr_getstack(&attr, &stack_addr, &stack_size);
+    pthread_attr_destroy(&attr);
+    profile_stack_low = (uintptr_t)stack_addr;
+    profile_stack_high = profile_stack_low + stack_size;
+
+    profile_samples = malloc(PROFILE_MAX_SAMPLES * sizeof(Profile_Sample));
+    if (!profile_samples) {
+        printf("ERROR: Could not allocate the sample buffer\n");
+        return;
+    }
+    profile_count = profile_dropped = 0;
+
+    struct sigaction sa, old_sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = profile_signal_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, &old_sa);
+
+    // Delivered to this thread. The CPU-time clock only fires on the kernel
+    // tick (1-10 ms) but leaves fn's sleeps and reads alone; the monotonic
+    // clock keeps the 100 µs interval and cuts them short with EINTR.
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    timer_t timer;
+    clockid_t clock = wall_clock ? CLOCK_MONOTONIC : CLOCK_THREAD_CPUTIME_ID;
+    if (timer_create(clock, &sev, &timer) != 0) {
+        printf("ERROR: Could not create the profiling timer: %s\n", strerror(errno));
+        sigaction(SIGPROF, &old_sa, NULL);
+        free(profile_samples);
+        profile_samples = NULL;
+        return;
+    }
+    struct itimerspec interval = {
+        .it_interval = { 0, PROFILE_INTERVAL_NS },
+        .it_value = { 0, PROFILE_INTERVAL_NS },
+    };
+    timer_settime(timer, 0, &interval, NULL);
+
+    unsigned long calls = 0;
+    uint64_t deadline = now_ns() + (uint64_t)PROFILE_DEFAULT_MS * 1000000ULL;
+    while (iterations ? calls < iterations : now_ns() < deadline) {
+        call_site_invoke(site, values->items, result);
+        calls++;
+    }
+
+    timer_delete(timer);
+    sigaction(SIGPROF, &old_sa, NULL);
+
+    profile_report(compiler, site, calls, wall_clock, folded_path[0] ? folded_path : NULL);
+    free(profile_samples);
+    profile_samples = NULL;
+#endif
+}
 
 // ============================================================================
 // Main REPL
 // ============================================================================
 
+// Brace balance of text, ignoring string and character literals
+static int brace_balance(const char *text, size_t len) {
+    int depth = 0;
+    char quote = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+        if (quote) {
+            if (c == '\\') i++;
+            else if (c == quote) quote = 0;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '{') {
+            depth++;
+        } else if (c == '}') {
+            depth--;
+        }
+    }
+    return depth;
+}
+
+// A :def whose braces are still open continues on the following lines.
+// Returns the whole definition (malloc()ed), or NULL if input ended first.
+static char *read_definition(String_View first) {
+    size_t size = first.count + 2;
+    char *text = malloc(size);
+    if (!text) return NULL;
+    memcpy(text, first.data, first.count);
+    size_t used = first.count;
+    text[used] = '\0';
+
+    while (brace_balance(text, used) > 0) {
+#ifdef HAVE_READLINE
+        char *more = readline("... ");
+        if (!more) {
+            free(text);
+            return NULL;
+        }
+#else
+        static char *more = NULL;
+        static size_t more_capacity = 0;
+        printf("... ");
+        fflush(stdout);
+        if (getline(&more, &more_capacity, stdin) < 0) {
+            free(text);
+            return NULL;
+        }
+        more[strcspn(more, "\n")] = '\0';
+#endif
+        size_t len = strlen(more);
+        char *grown = realloc(text, used + len + 2);
+        if (grown) {
+            text = grown;
+            text[used++] = '\n';
+            memcpy(text + used, more, len + 1);
+            used += len;
+        }
+#ifdef HAVE_READLINE
+        free(more);
+#endif
+        if (!grown) {
+            free(text);
+            return NULL;
+        }
+    }
+    return text;
+}
+
 int main(int argc, char **argv) {
+    // Strip option flags so the positional arguments keep their meaning
+    bool watch_flag = false;
+    int positional = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--watch") == 0) {
+            watch_flag = true;
+        } else if (strcmp(argv[i], "--compile-stats") == 0) {
+            compile_stats_verbose = true;
+        } else if (strcmp(argv[i], "--perf-map") == 0) {
+            if (!jit_perf_map_open()) return 1;
+        } else if (strcmp(argv[i], "--jitdump") == 0) {
+            if (!jitdump_open()) return 1;
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            if (library_load(argv[++i]) == LIBRARY_NONE) return 1;
+        } else {
+            argv[positional++] = argv[i];
+        }
+    }
+    argc = positional;
+    argv[argc] = NULL;
+
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <source.c> OR %s <0|1> <file>\n", argv[0], argv[0]);
+        fprintf(stderr, "Usage: %s [--watch] [--compile-stats] [--perf-map] [--jitdump] [--load lib] <source.c> [more.c ...]"
+                        " OR %s [options] <dir> OR %s <0|1> <file>\n", argv[0], argv[0], argv[0]);
         fprintf(stderr, "ERROR: no input source file provided\n");
         return 1;
     }
 
-launch:
     setup_signal_handlers();
     char *source_code = NULL;
     char source_path[10240];
     memset(source_path, 0, 10240*sizeof(char));
     int encryption_mode = -1;
 
-    source_code = read_enc_dec_managed(argv[1], argv[2], argc, &encryption_mode, source_path);
+    bool encryption_arg = strcmp(argv[1], "0") == 0 || strcmp(argv[1], "1") == 0;
+    if (!encryption_arg && project_init(argc - 1, argv + 1)) {
+        snprintf(source_path, sizeof(source_path), "%s",
+                 project_dir ? project_dir : project_units.items[0]);
+        printf("Project: %zu translation units\n", project_units.count);
+        source_code = project_read_sources(&project_units);
+        if (!source_code) {
+            fprintf(stderr, "ERROR: Could not read project sources\n");
+            return 1;
+        }
+    } else {
+        source_code = read_enc_dec_managed(argv[1], argv[2], argc, &encryption_mode, source_path);
+    }
 
     // Create and configure compiler
-    Compiler_Context *compiler = NULL;
-    compiler = compile(source_code, source_path);
-    compiler->source_code = source_code;
+    // Decrypted sources never touch the disk, so they bypass the image cache
+    active_compiler = compile(source_code, source_path, encryption_mode != 0);
+    active_compiler->source_code = source_code;  // Owned by the context from now on
+    source_code = NULL;
+    if (compile_stats_verbose) print_compile_stats(&active_compiler->stats);
+    cache_stats_publish(&active_compiler->cache);
+    jit_export_context(active_compiler, 0);
+    baseline_rss = resident_memory_bytes();
 
 #ifdef HAVE_READLINE
     // Update global compiler pointer for autocomplete
-    g_compiler_for_completion = compiler;
+    g_compiler_for_completion = active_compiler;
 #endif
 
     // Print welcome message
@@ -1213,19 +5366,24 @@ launch:
            "Type :help for commands, :quit or Ctrl+C to exit\n\n", source_path);
 
     // REPL state (allocated once, reused)
-    ffi_cif cif;
     Type_Array types = {0};
     Value_Array values = {0};
-    stb_lexer lexer;
-    static char string_store[4096];
     char *line = NULL;
+#ifndef HAVE_READLINE
+    size_t line_capacity = 0;
+#endif
 
 #ifdef HAVE_READLINE
     // Initialize readline history
     init_readline_history();
-    setup_readline_completion(compiler);  // Pass compiler context!
+    setup_readline_completion(active_compiler);  // Pass compiler context!
+    rl_event_hook = repl_event_hook;
 #endif
 
+    if (watch_flag && watch_start(source_path, encryption_mode)) {
+        printf("Watching %s for changes\n\n", source_path);
+    }
+
     // Main REPL loop
     for (;;) {
         // Reset temp memory and arrays (preserve capacity)
@@ -1233,6 +5391,9 @@ launch:
         types.count = 0;
         values.count = 0;
 
+        // Install a finished background reload before reading the next call
+        repl_poll_events(false);
+
 #ifdef HAVE_READLINE
         // Use readline for better input with history
         if (line) {
@@ -1259,19 +5420,24 @@ launch:
             continue;
         }
 #else
-        // Fallback to basic fgets if readline not available
-        static char line_buffer[4096];
+        // Fallback to getline() if readline not available (no length limit)
         printf("> ");
         fflush(stdout);
 
-        if (!fgets(line_buffer, sizeof(line_buffer), stdin)) break;
-        
-        line = line_buffer;
+        if (getline(&line, &line_capacity, stdin) < 0) break;
+
         String_View input = sv_trim(sv_from_cstr(line));
         if (input.count == 0) continue;
 #endif
 
+        // Readline's event hook may have installed a reload while we waited
+        repl_poll_events(false);
+        Compiler_Context *compiler = active_compiler;
+        String_View call = input;
+        bool arena_call = arena_calls;
+
         // Check for builtin commands
+        String_View arg;
         if (input.data[0] == ':') {
             if (sv_eq(input, sv_from_cstr(":quit")) || sv_eq(input, sv_from_cstr(":q"))) {
                 break;
@@ -1279,84 +5445,297 @@ launch:
                 print_help();
                 continue;
             } else if (sv_eq(input, sv_from_cstr(":info"))) {
+                const char *dir = cache_dir();
                 printf("\nCompilation info:\n"
-                    "  Source: %s\n"
+                    "  Source: %s (%zu translation unit(s))\n"
+                    "  Image: %s (%.2f ms)\n"
+                    "  Image cache: %s (hits=%u, misses=%u, saved %.2f ms)\n"
+                    "  Header snapshot: %s\n"
+                    "  Memory: RSS %.1f MiB (%.1f MiB after the first compile, %u reload(s) since)\n"
+                    "  Call-site cache: %zu site(s) (hits=%lu, misses=%lu)\n"
+                    "  Direct-call stubs: %zu signature(s)\n"
+                    "  Temp arena: %zu byte(s) last input, high water %zu, %zu chunk(s) held, %zu chunk malloc(s)\n"
                     "  Arrays capacity: types=%zu, values=%zu\n\n",
-                    source_path, types.capacity, values.capacity);
+                    source_path, project_units.count > 0 ? project_units.count : (size_t)1,
+                    compiler->image_handle ? (cache_stats.last_hit ? "cache hit" : "cache miss, stored")
+                                           : "in-memory",
+                    cache_stats.last_ms,
+                    dir && encryption_mode != 0 ? dir : "disabled",
+                    cache_stats.hits, cache_stats.misses, cache_stats.saved_ms,
+                    cache_stats.last_snapshot ? "used" :
+                        (compiler->image_handle && cache_stats.last_hit ? "not needed (cached image)" : "not used"),
+                    resident_memory_bytes() / (1024.0 * 1024.0), baseline_rss / (1024.0 * 1024.0),
+                    reload_count, call_cache.count, call_cache.hits, call_cache.misses, stub_count(),
+                    temp_arena.last_bytes, temp_arena.high_water, temp_arena.chunks,
+                    temp_arena.chunk_allocs, types.capacity, values.capacity);
                 continue;
             } else if (sv_eq(input, sv_from_cstr(":list")) || sv_eq(input, sv_from_cstr(":l"))) {
                 list_functions(compiler);
                 continue;
+            } else if (sv_eq(input, sv_from_cstr(":watch on"))) {
+                if (watch_start(source_path, encryption_mode)) {
+                    printf("Watching %zu file(s) for changes\n", watch.file_count);
+                }
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":watch off"))) {
+                watch_stop();
+                printf("Watch mode off\n");
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":watch"))) {
+                if (!watch.active) {
+                    printf("Watch mode off (:watch on to enable)\n");
+                } else {
+                    printf("Watching (%u change(s) picked up):\n", watch.changes);
+                    for (size_t i = 0; i < watch.file_count; i++) {
+                        printf("  %s\n", watch.files[i]);
+                    }
+                }
+                continue;
             } else if (sv_eq(input, sv_from_cstr(":reload")) || sv_eq(input, sv_from_cstr(":r"))) {
-                // Create and configure compiler again
-
-                // cleanup_resources(compiler, &types, &values, source_code, encryption_mode);
-
-                goto launch;
+                reload_start(source_path, encryption_mode);
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":compile-stats"))) {
+                print_compile_stats(&compiler->stats);
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":compile-stats headers"))) {
+                print_header_costs(compiler);
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":compile-stats on")) ||
+                       sv_eq(input, sv_from_cstr(":compile-stats off"))) {
+                compile_stats_verbose = input.data[input.count - 1] == 'n';
+                printf("Compile stats after every compile: %s\n", compile_stats_verbose ? "on" : "off");
+                continue;
+            } else if (sv_chop_prefix(input, ":def", &arg)) {
+                if (arg.count == 0) {
+                    if (session_defs.count == 0) printf("No definitions (:def <code> adds one)\n");
+                    for (size_t i = 0; i < session_defs.count; i++) {
+                        printf("#%zu:\n%s\n", i + 1, session_defs.items[i]);
+                    }
+                    continue;
+                }
+                if (reload_job.running) {
+                    printf("ERROR: wait for the running reload to finish\n");
+                    continue;
+                }
+                if (sv_eq(arg, sv_from_cstr("clear"))) {
+                    delta_clear(compiler);
+                    printf("Dropped %zu definition(s)\n", session_defs.count);
+                    string_array_free(&session_defs);
+                    continue;
+                }
+                char *definition = read_definition(arg);
+                if (!definition) continue;
+                double start = now_ms();
+                if (delta_apply(compiler, definition)) {
+                    const Delta_Unit *delta = &compiler->deltas.items[compiler->deltas.count - 1];
+                    printf("Defined");
+                    for (size_t i = 0; i < delta->names.count; i++) {
+                        printf("%s %s", i ? "," : "", delta->names.items[i]);
+                    }
+                    printf(" in %.2f ms\n", now_ms() - start);
+                    da_append(&session_defs, definition);
+                    call_cache_clear();
+                    jit_export_context(compiler, (unsigned)compiler->deltas.count);
+                } else {
+                    free(definition);
+                }
+                continue;
+            } else if (sv_chop_prefix(input, ":load", &arg)) {
+                if (arg.count == 0) {
+                    if (loaded_libraries.count == 0) printf("No libraries loaded\n");
+                    for (size_t i = 0; i < loaded_libraries.count; i++) {
+                        printf("  %s\n", loaded_libraries.items[i].path);
+                    }
+                    continue;
+                }
+                if (reload_job.running) {
+                    printf("ERROR: wait for the running reload to finish\n");
+                    continue;
+                }
+                char path[4096];
+                snprintf(path, sizeof(path), "%.*s", (int)arg.count, arg.data);
+                Library_Kind kind = library_load(path);
+                if (kind == LIBRARY_SHARED) {
+                    printf("Loaded %s; its exported functions are callable and visible to new compiles\n",
+                           loaded_libraries.items[loaded_libraries.count - 1].path);
+                } else if (kind != LIBRARY_NONE) {
+                    // Archives and objects are linked into the image itself
+                    printf("Linking %s into the image\n", loaded_libraries.items[loaded_libraries.count - 1].path);
+                    if (reload_start(source_path, encryption_mode)) {
+                        reload_job.drop_library = true;
+                    } else {
+                        library_drop_last();
+                    }
+                }
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":tier"))) {
+                tier_print_status(compiler);
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":tier on")) || sv_eq(input, sv_from_cstr(":tier off"))) {
+                tier_auto = input.data[input.count - 1] == 'n';
+                printf("Automatic promotion %s\n", tier_auto ? "on" : "off");
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":time"))) {
+                printf("Per-call timing is %s\n", time_calls ? "on" : "off");
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":time on")) || sv_eq(input, sv_from_cstr(":time off"))) {
+                time_calls = input.data[input.count - 1] == 'n';
+                printf("Per-call timing %s\n", time_calls ? "on" : "off");
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":rusage"))) {
+                printf("Per-call resource usage is %s\n", rusage_calls ? "on" : "off");
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":rusage on")) || sv_eq(input, sv_from_cstr(":rusage off"))) {
+                rusage_calls = input.data[input.count - 1] == 'n';
+                printf("Per-call resource usage %s\n", rusage_calls ? "on" : "off");
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":allocs"))) {
+                size_t bytes;
+                size_t blocks = alloc_live_blocks(&bytes);
+                printf("Allocation tracking is %s", alloc_counting ? "on" : "off");
+                if (alloc_counting && !compiler->alloc_hooked) printf(" (waiting for the rebuild)");
+                printf("; %zu tracked block(s) live, %zu bytes\n", blocks, bytes);
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":allocs on")) || sv_eq(input, sv_from_cstr(":allocs off"))) {
+                bool on = input.data[input.count - 1] == 'n';
+                if (on == alloc_counting) {
+                    printf("Allocation tracking is already %s\n", on ? "on" : "off");
+                    continue;
+                }
+                // Blocks from before can be freed behind the tracker's back
+                alloc_counting = on;
+                alloc_tracker_free();
+                if (!alloc_hooks_update(source_path, encryption_mode)) {
+                    alloc_counting = !on;
+                    continue;
+                }
+                printf("Allocation tracking %s%s\n", on ? "on" : "off",
+                       reload_job.running ? " once the rebuild finishes" : "");
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":arena"))) {
+                printf("Arena calls are %s", arena_calls ? "on" : "off");
+                if (arena_calls && !compiler->alloc_hooked) printf(" (waiting for the rebuild)");
+                printf("\n");
+                if (bump_arena.base) bump_arena_print();
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":arena on")) || sv_eq(input, sv_from_cstr(":arena off"))) {
+                bool on = input.data[input.count - 1] == 'n';
+                if (on == arena_calls) {
+                    printf("Arena calls are already %s\n", on ? "on" : "off");
+                    continue;
+                }
+                if (on && !bump_arena_init()) {
+                    printf("ERROR: Could not reserve the arena: %s\n", strerror(errno));
+                    continue;
+                }
+                arena_calls = on;
+                if (!alloc_hooks_update(source_path, encryption_mode)) {
+                    arena_calls = !on;
+                    continue;
+                }
+                printf("Arena calls %s%s\n", on ? "on" : "off",
+                       reload_job.running ? " once the rebuild finishes" : "");
+                continue;
+            } else if (sv_chop_prefix(input, ":arena", &arg)) {
+                // One call on the arena, then on to the call below
+                if (!compiler->alloc_hooked) {
+                    printf("ERROR: the image isn't linked with the allocator hooks (:arena on or :allocs on)\n");
+                    continue;
+                }
+                if (!bump_arena_init()) {
+                    printf("ERROR: Could not reserve the arena: %s\n", strerror(errno));
+                    continue;
+                }
+                call = arg;
+                arena_call = true;
+            } else if (sv_eq(input, sv_from_cstr(":counters"))) {
+                printf("Hardware counters are %s\n", counters.leader >= 0 ? "on" : "off");
+                continue;
+            } else if (sv_eq(input, sv_from_cstr(":counters on")) || sv_eq(input, sv_from_cstr(":counters off"))) {
+                counters_enable(input.data[input.count - 1] == 'n');
+                continue;
+            } else if (sv_chop_prefix(input, ":profile", &arg)) {
+                profile_run(compiler, arg, &types, &values);
+                continue;
+            } else if (sv_chop_prefix(input, ":bench", &arg)) {
+                bench_run(compiler, arg, &types, &values);
+                continue;
+            } else if (sv_chop_prefix(input, ":optimize", &arg)) {
+                char name[256];
+                snprintf(name, sizeof(name), "%.*s", (int)arg.count, arg.data);
+                if (!name[0]) {
+                    printf("Usage: :optimize <function>\n");
+                } else if (!compiler_get_symbol(compiler, name)) {
+                    printf("ERROR: function '%s' not found\n", name);
+                } else if (tier_promote(compiler, tier_lookup(compiler, name))) {
+                    printf("'%s' now runs optimized code%s\n", name,
+                           compiler->alloc_hooked ? " once :allocs and :arena are off" : "");
+                }
+                continue;
             } else {
                 printf("ERROR: unknown command. Type :help for available commands\n");
                 continue;
             }
         }
 
-        // Parse function call - use original line buffer which is properly null-terminated
-        stb_c_lexer_init(&lexer, line, line + strlen(line),
-                        string_store, sizeof(string_store));
-
-        if (!stb_c_lexer_get_token(&lexer)) continue;
-
-        if (lexer.token != CLEX_id) {
-            printf("ERROR: function name must be an identifier\n");
-            continue;
-        }
-
-        // Save function name (lexer.string gets overwritten during parse_arguments)
-        char function_name[256];
-        strncpy(function_name, lexer.string, sizeof(function_name) - 1);
-        function_name[sizeof(function_name) - 1] = '\0';
-
-        // Look up function
-        void *func_ptr = compiler_get_symbol(compiler, function_name);
-        if (!func_ptr) {
-            printf("ERROR: function '%s' not found\n", function_name);
-            printf("Hint: Make sure the function is defined and not static\n");
-            continue;
-        }
-
-        // Parse arguments
-        if (!parse_arguments(&lexer, &types, &values)) continue;
-
-        // Detect return type using saved function name
-        ffi_type *return_type = detect_return_type(function_name, compiler->source_code);
+        // Parse and resolve the function call
+        uint64_t repl_start = now_ns();
+        Call_Site *site = prepare_call(compiler, call, &types, &values);
+        if (!site) continue;
+        ffi_type *return_type = site->return_type;
 
         // Prepare storage for return value
-        void *result = NULL;
-        if (return_type != &ffi_type_void) {
-            result = temp_alloc(return_type->size);
-            if (!result) {
-                printf("ERROR: Could not allocate memory for return value\n");
-                continue;
-            }
-            // Initialize to zero to avoid garbage data
-            memset(result, 0, return_type->size);
+        void *result = call_result_buffer(site);
+        if (!result && return_type != &ffi_type_void) {
+            printf("ERROR: Could not allocate memory for return value\n");
+            continue;
         }
 
-        // Prepare and execute FFI call
-        ffi_status status = ffi_prep_cif(&cif, FFI_DEFAULT_ABI, types.count,
-                                        return_type, types.items);
-        if (status != FFI_OK) {
-            printf("ERROR: could not prepare FFI call (status: %d)\n", status);
-            continue;
+        // Execute the function through its prepared call site
+        size_t tier_index = site->tier_index;
+        Perf_Sample sample;
+        bool counted = false;
+        Resource_Usage usage_before, usage_after;
+        Alloc_Stats allocs;
+        bool track_allocs = compiler->alloc_hooked && alloc_counting;
+        arena_call = arena_call && compiler->alloc_hooked;
+        if (rusage_calls) resource_usage_now(&usage_before);
+        if (arena_call) alloc_backend = ALLOC_BACKEND_BUMP;
+        if (track_allocs) alloc_window_begin();
+        if (counters.leader >= 0) perf_group_start(&counters);
+        uint64_t call_start = now_ns();
+        call_site_invoke(site, values.items, result);
+        uint64_t call_ns = now_ns() - call_start;
+        if (counters.leader >= 0) counted = perf_group_stop(&counters, &sample);
+        if (track_allocs) alloc_window_end(&allocs);
+        alloc_backend = ALLOC_BACKEND_LIBC;
+        if (rusage_calls) resource_usage_now(&usage_after);
+        double call_ms = call_ns / 1e6;
+
+        // :time splits the latency into REPL work (lex, lookup, argument
+        // and call preparation) and the function itself
+        char note[96] = "";
+        if (time_calls) {
+            char repl[32], inside[32];
+            snprintf(note, sizeof(note), "    [%s REPL + %s in %s]",
+                     format_ns((double)(call_start - repl_start), repl, sizeof(repl)),
+                     format_ns((double)call_ns, inside, sizeof(inside)), site->name);
         }
-        // Execute the function
-        ffi_call(&cif, (void(*)())func_ptr, result, values.items);
 
         // Display the return value
         if (return_type == &ffi_type_void || result != NULL) {
-            display_return_value(return_type, result);
+            display_return_value(return_type, result, note);
         } else {
             printf("→ [error: no result available]\n");
         }
+        if (counted) perf_sample_print(&sample, 1.0);
+        if (rusage_calls) print_resource_usage(&usage_before, &usage_after, 1.0);
+        if (track_allocs) alloc_stats_print(&allocs, 1.0);
+        if (arena_call) {
+            bump_arena_reset();  // Only now: the result may point into the arena
+            bump_arena_print();
+        }
+        tier_record_call(compiler, &compiler->tier.items[tier_index], call_ms);
     }
 
     printf("\nGoodbye!\n");
@@ -1364,15 +5743,25 @@ launch:
 #ifdef HAVE_READLINE
     // Save history before exit
     save_readline_history();
-    
-    // Free last line
-    if (line) {
-        free(line);
-    }
 #endif
-
-    // Cleanup
-    cleanup_resources(compiler, &types, &values, source_code, encryption_mode);
+    free(line);  // Last readline() / getline() buffer
+
+    // Cleanup (the active context owns the source code)
+    watch_stop();
+    free(watch.source_path);
+    path_array_clear(&project_units);
+    da_free(&project_units);
+    free(project_dir);
+    reload_abandon();
+    cleanup_resources(active_compiler, &types, &values, source_code, encryption_mode);
+    string_array_free(&session_defs);
+    call_cache_free();
+    stub_cache_free();
+    perf_group_close(&counters);
+    jit_export_close();
+    alloc_tracker_free();
+    bump_arena_free();
+    library_unload_all();
 
     return 0;
 }
\ No newline at end of file
@@ -1,3 +1,23 @@
+// Progress and error messages of the fetch/decrypt path. A thread that sets
+// a sink (background reloads, whose output would garble the prompt) gets one
+// line per call there; otherwise progress goes to stdout, errors to stderr.
+static _Thread_local void (*source_message_func)(void *opaque, const char *msg) = NULL;
+static _Thread_local void *source_message_opaque = NULL;
+
+static void source_message(FILE *out, const char *fmt, ...) {
+    char msg[1024];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+
+    if (source_message_func) {
+        source_message_func(source_message_opaque, msg);
+    } else {
+        fprintf(out, "%s\n", msg);
+    }
+}
+
 // Check if the path is a URL
 int is_url(const char* path) {
     return (strncmp(path, "http://", 7) == 0 || 
@@ -18,8 +38,8 @@ static size_t write_memory_callback(void *contents, size_t size, size_t nmemb, v
     // Reallocate buffer to accommodate new data
     char *new_data = realloc(buffer->data, buffer->size + total_size + 1);
     if (!new_data) {
-        fprintf(stderr, "ERROR: Memory reallocation failed (%zu + %zu bytes)\n", 
-                buffer->size, total_size);
+        source_message(stderr, "ERROR: Memory reallocation failed (%zu + %zu bytes)",
+                       buffer->size, total_size);
         return 0; // Return 0 to indicate failure to libcurl
     }
 
@@ -35,7 +55,7 @@ static size_t write_memory_callback(void *contents, size_t size, size_t nmemb, v
 static int init_memory_buffer(MemoryBuffer *buffer) {
     buffer->data = malloc(1); // Start with minimal allocation
     if (!buffer->data) {
-        fprintf(stderr, "ERROR: Initial memory allocation failed\n");
+        source_message(stderr, "ERROR: Initial memory allocation failed");
         return -1;
     }
     buffer->data[0] = '\0';
@@ -52,11 +72,11 @@ char* download_from_url(const char* url) {
 
     // Validate input
     if (!url || strlen(url) == 0) {
-        fprintf(stderr, "ERROR: Invalid URL provided\n");
+        source_message(stderr, "ERROR: Invalid URL provided");
         return NULL;
     }
 
-    printf("Downloading from: %s\n", url);
+    source_message(stdout, "Downloading from: %s", url);
 
     // Initialize memory buffer
     if (init_memory_buffer(&buffer) != 0) {
@@ -68,7 +88,7 @@ char* download_from_url(const char* url) {
     curl = curl_easy_init();
     
     if (!curl) {
-        fprintf(stderr, "ERROR: Failed to initialize CURL\n");
+        source_message(stderr, "ERROR: Failed to initialize CURL");
         goto cleanup;
     }
 
@@ -95,15 +115,15 @@ char* download_from_url(const char* url) {
     res = curl_easy_perform(curl);
 
     if (res != CURLE_OK) {
-        fprintf(stderr, "ERROR: Download failed: %s\n", curl_easy_strerror(res));
+        source_message(stderr, "ERROR: Download failed: %s", curl_easy_strerror(res));
         
         // Provide more specific error messages for common cases
         if (res == CURLE_COULDNT_CONNECT) {
-            fprintf(stderr, "Hint: Check if the server is running and accessible\n");
+            source_message(stderr, "Hint: Check if the server is running and accessible");
         } else if (res == CURLE_SSL_CONNECT_ERROR) {
-            fprintf(stderr, "Hint: SSL/TLS connection issue - check certificate configuration\n");
+            source_message(stderr, "Hint: SSL/TLS connection issue - check certificate configuration");
         } else if (res == CURLE_OPERATION_TIMEDOUT) {
-            fprintf(stderr, "Hint: Connection timed out - check network connectivity\n");
+            source_message(stderr, "Hint: Connection timed out - check network connectivity");
         }
         
         goto cleanup;
@@ -111,11 +131,11 @@ char* download_from_url(const char* url) {
 
     // Verify we actually got data
     if (buffer.size == 0) {
-        fprintf(stderr, "ERROR: Empty response received from server\n");
+        source_message(stderr, "ERROR: Empty response received from server");
         goto cleanup;
     }
 
-    printf("Downloaded %zu bytes successfully\n", buffer.size);
+    source_message(stdout, "Downloaded %zu bytes successfully", buffer.size);
     
     // Return the data (transfer ownership to caller)
     result = buffer.data;
@@ -0,0 +1,345 @@
+// ============================================================================
+// Hardware Performance Counters
+// ============================================================================
+//
+// One perf_event group on the calling thread (cycles, instructions, cache
+// misses, branch misses, L1d read misses), counting user space only so it
+// works up to perf_event_paranoid=2 without privileges. Counters the CPU or
+// kernel doesn't provide (common in virtual machines) are left out of the
+// group; the group is usable as long as one of them opens. The members are
+// read together, and scaled when the kernel had to multiplex them.
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_COUNTER_COUNT
+} Perf_Counter;
+
+typedef struct {
+    int fd[PERF_COUNTER_COUNT];         // -1 when unavailable
+    uint64_t id[PERF_COUNTER_COUNT];
+    int leader;                         // fd of the group leader, -1 if closed
+} Perf_Group;
+
+typedef struct {
+    uint64_t value[PERF_COUNTER_COUNT];
+    bool valid[PERF_COUNTER_COUNT];
+    bool multiplexed;                   // Values were scaled up
+} Perf_Sample;
+
+static const char *perf_counter_names[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "cache-misses", "branch-misses", "L1d-misses"
+};
+
+static void perf_counter_attr(Perf_Counter counter, struct perf_event_attr *attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->type = PERF_TYPE_HARDWARE;
+    switch (counter) {
+        case PERF_CYCLES:        attr->config = PERF_COUNT_HW_CPU_CYCLES; break;
+        case PERF_INSTRUCTIONS:  attr->config = PERF_COUNT_HW_INSTRUCTIONS; break;
+        case PERF_CACHE_MISSES:  attr->config = PERF_COUNT_HW_CACHE_MISSES; break;
+        case PERF_BRANCH_MISSES: attr->config = PERF_COUNT_HW_BRANCH_MISSES; break;
+        case PERF_L1D_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_L1D |
+                           (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        default: break;
+    }
+    attr->disabled = 1;                 // Only the leader's bit matters
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+                        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+}
+
+// Why the group couldn't open, for the error message
+static void perf_explain(int err, char *why, size_t why_size) {
+    if (err == EACCES || err == EPERM) {
+        int paranoid = -1;
+        FILE *f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+        if (f) {
+            if (fscanf(f, "%d", &paranoid) != 1) paranoid = -1;
+            fclose(f);
+        }
+        snprintf(why, why_size,
+                 "access denied (perf_event_paranoid=%d; user-space counting needs 2 or less, or CAP_PERFMON)",
+                 paranoid);
+    } else if (err == ENOENT || err == ENODEV || err == EOPNOTSUPP) {
+        snprintf(why, why_size, "no hardware counters available (virtual machine or unsupported CPU)");
+    } else if (err == ENOSYS) {
+        snprintf(why, why_size, "kernel built without perf events");
+    } else {
+        snprintf(why, why_size, "%s", strerror(err));
+    }
+}
+
+// Open the group on the calling thread. On failure fills why and returns false.
+bool perf_group_open(Perf_Group *group, char *why, size_t why_size) {
+    group->leader = -1;
+    int first_error = 0;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        perf_counter_attr((Perf_Counter)i, &attr);
+        group->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group->leader, 0);
+        if (group->fd[i] < 0) {
+            if (!first_error) first_error = errno;
+            continue;
+        }
+        if (ioctl(group->fd[i], PERF_EVENT_IOC_ID, &group->id[i]) != 0) {
+            close(group->fd[i]);
+            group->fd[i] = -1;
+            continue;
+        }
+        if (group->leader < 0) group->leader = group->fd[i];
+    }
+
+    if (group->leader < 0) {
+        perf_explain(first_error ? first_error : ENOENT, why, why_size);
+        return false;
+    }
+    return true;
+}
+
+void perf_group_close(Perf_Group *group) {
+    if (group->leader < 0) return;  // Never opened (fds may be zero-initialized)
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (group->fd[i] >= 0) close(group->fd[i]);
+        group->fd[i] = -1;
+    }
+    group->leader = -1;
+}
+
+static inline void perf_group_start(Perf_Group *group) {
+    ioctl(group->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(group->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+// Stop counting and read the group. False if the kernel never got to
+// schedule it (more members than the PMU has counters, or a busy PMU).
+static inline bool perf_group_stop(Perf_Group *group, Perf_Sample *sample) {
+    ioctl(group->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    // nr, time_enabled, time_running, then { value, id } per member
+    uint64_t buffer[3 + 2 * PERF_COUNTER_COUNT];
+    memset(sample, 0, sizeof(*sample));
+    if (read(group->leader, buffer, sizeof(buffer)) < (ssize_t)(3 * sizeof(uint64_t))) return false;
+
+    uint64_t members = buffer[0], enabled = buffer[1], running = buffer[2];
+    if (running == 0) return false;
+    sample->multiplexed = running < enabled;
+
+    for (uint64_t m = 0; m < members && m < PERF_COUNTER_COUNT; m++) {
+        uint64_t value = buffer[3 + 2 * m], id = buffer[4 + 2 * m];
+        if (sample->multiplexed) value = (uint64_t)((double)value * enabled / running);
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            if (group->fd[i] >= 0 && group->id[i] == id) {
+                sample->value[i] = value;
+                sample->valid[i] = true;
+            }
+        }
+    }
+    return true;
+}
+
+// "cycles 1234  instructions 5678 (IPC 4.60)  ..." with every value divided by calls
+void perf_sample_print(const Perf_Sample *sample, double calls) {
+    printf("  ");
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (!sample->valid[i]) continue;
+        printf("%s %.*f", perf_counter_names[i], calls > 1 ? 2 : 0, sample->value[i] / calls);
+        if (i == PERF_INSTRUCTIONS && sample->valid[PERF_CYCLES] && sample->value[PERF_CYCLES] > 0) {
+            printf(" (IPC %.2f)", (double)sample->value[PERF_INSTRUCTIONS] / sample->value[PERF_CYCLES]);
+        }
+        printf("  ");
+    }
+    printf("%s%s\n", calls > 1 ? "per call" : "",
+           sample->multiplexed ? " (multiplexed, scaled)" : "");
+}
+
+// ============================================================================
+// JIT Symbol Export
+// ============================================================================
+//
+// TCC relocates compiled code into anonymous memory, which perf can't
+// symbolize on its own. Two ways to describe it, both opt-in:
+//   - a perf map, /tmp/perf-<pid>.map, one "start size name" line per
+//     function, read by perf report/top as is;
+//   - a jitdump, /tmp/jit-<pid>.dump, with the load time and bytes of every
+//     function, for `perf record -k mono` then `perf inject --jit`. perf
+//     finds it through the executable mapping of the file made on open.
+// Entries are only ever appended; recompiled code gets an entry of its own.
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define JITDUMP_MAGIC     0x4A695444  // "JiTD"
+#define JITDUMP_VERSION   1
+#define JIT_CODE_LOAD     0
+#define JIT_CODE_CLOSE    3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;                // Of this header
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} Jitdump_Header;
+
+typedef struct {
+    uint32_t id;
+    uint32_t total_size;                // Of the whole record
+    uint64_t timestamp;
+} Jitdump_Record;
+
+typedef struct {
+    Jitdump_Record record;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    // Followed by the NUL-terminated name and code_size bytes of code
+} Jitdump_Code_Load;
+
+static FILE *jit_perf_map = NULL;
+static FILE *jit_dump = NULL;
+static void *jit_dump_marker = NULL;    // The mapping perf record looks for
+static size_t jit_dump_marker_size = 0;
+static uint64_t jit_code_index = 0;
+
+// Must match the clock perf record was told to use (-k mono)
+static uint64_t jit_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool jit_export_enabled(void) {
+    return jit_perf_map || jit_dump;
+}
+
+bool jit_perf_map_open(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    jit_perf_map = fopen(path, "w");    // A stale map of a recycled pid is wrong
+    if (!jit_perf_map) {
+        fprintf(stderr, "ERROR: Could not create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool jitdump_open(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/jit-%d.dump", (int)getpid());
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Could not create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    Jitdump_Header header = {
+        .magic = JITDUMP_MAGIC,
+        .version = JITDUMP_VERSION,
+        .total_size = sizeof(Jitdump_Header),
+#if defined(__x86_64__)
+        .elf_mach = EM_X86_64,
+#elif defined(__aarch64__)
+        .elf_mach = EM_AARCH64,
+#else
+        .elf_mach = EM_NONE,
+#endif
+        .pid = (uint32_t)getpid(),
+        .timestamp = jit_timestamp(),
+    };
+    jit_dump_marker_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        fprintf(stderr, "ERROR: Could not write %s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    jit_dump_marker = mmap(NULL, jit_dump_marker_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if (jit_dump_marker == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Could not map %s: %s\n", path, strerror(errno));
+        jit_dump_marker = NULL;
+        close(fd);
+        return false;
+    }
+    jit_dump = fdopen(fd, "a");
+    if (!jit_dump) {
+        munmap(jit_dump_marker, jit_dump_marker_size);
+        jit_dump_marker = NULL;
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+// Describe size bytes of code at addr as name. No-op unless an output is open.
+void jit_export_code(const void *addr, size_t size, const char *name) {
+    if (!addr || size == 0) return;
+
+    if (jit_perf_map) {
+        fprintf(jit_perf_map, "%lx %zx %s\n", (unsigned long)(uintptr_t)addr, size, name);
+        fflush(jit_perf_map);
+    }
+
+    if (jit_dump) {
+        size_t name_size = strlen(name) + 1;
+        Jitdump_Code_Load load = {
+            .record = {
+                .id = JIT_CODE_LOAD,
+                .total_size = (uint32_t)(sizeof(load) + name_size + size),
+                .timestamp = jit_timestamp(),
+            },
+            .pid = (uint32_t)getpid(),
+            .tid = (uint32_t)syscall(SYS_gettid),
+            .vma = (uint64_t)(uintptr_t)addr,
+            .code_addr = (uint64_t)(uintptr_t)addr,
+            .code_size = size,
+            .code_index = jit_code_index++,
+        };
+        fwrite(&load, sizeof(load), 1, jit_dump);
+        fwrite(name, 1, name_size, jit_dump);
+        fwrite(addr, 1, size, jit_dump);
+        fflush(jit_dump);
+    }
+}
+
+// The files stay behind for perf report / perf inject to read
+void jit_export_close(void) {
+    if (jit_perf_map) {
+        fclose(jit_perf_map);
+        jit_perf_map = NULL;
+    }
+    if (jit_dump) {
+        Jitdump_Record close_record = {
+            .id = JIT_CODE_CLOSE,
+            .total_size = sizeof(Jitdump_Record),
+            .timestamp = jit_timestamp(),
+        };
+        fwrite(&close_record, sizeof(close_record), 1, jit_dump);
+        fclose(jit_dump);
+        jit_dump = NULL;
+        munmap(jit_dump_marker, jit_dump_marker_size);
+        jit_dump_marker = NULL;
+    }
+}
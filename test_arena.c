@@ -0,0 +1,129 @@
+// ============================================================================
+// Steady-State Allocation Test
+// ============================================================================
+//
+// Drives the REPL call path (temp_reset, prepare_call, call_result_buffer,
+// call_site_invoke) over and over and checks that, once the first round has
+// warmed the call cache and the temp arena, no further call reaches malloc()
+// and the arena never asks for another chunk.
+//
+// Build and run: make test-arena
+// malloc, calloc and realloc are wrapped at link time (-Wl,--wrap=...), so
+// only calls made by the REPL code itself are counted.
+
+#define main malcrepl_main
+#include "malcrepl.c"
+#undef main
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static unsigned long test_mallocs = 0;
+
+void *__wrap_malloc(size_t size) {
+    test_mallocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    test_mallocs++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    test_mallocs++;
+    return __real_realloc(ptr, size);
+}
+
+static const char *test_source =
+    "int add(int a, int b) { return a + b; }\n"
+    "double scale(double x, int n) { return x * n; }\n"
+    "int length(char *s) { int n = 0; while (s[n]) n++; return n; }\n"
+    "void touch(void) {}\n";
+
+typedef struct {
+    const char *call;
+    long expected;      // Integer results only
+} Test_Call;
+
+static const Test_Call test_calls[] = {
+    { "add 2 3", 5 },
+    { "scale 1.5 4", 0 },
+    { "length \"hello, arena\"", 12 },
+    { "length \"tab\\tand \\\"quotes\\\"\"", 16 },
+    { "touch", 0 },
+};
+
+#define TEST_CALL_COUNT (sizeof(test_calls) / sizeof(test_calls[0]))
+#define TEST_WARMUP_ROUNDS 2
+#define TEST_ROUNDS 10000
+
+// One REPL iteration: false if the call could not be prepared or its integer
+// result is wrong
+static bool test_run_call(Compiler_Context *compiler, const Test_Call *test,
+                          Type_Array *types, Value_Array *values) {
+    temp_reset();
+    types->count = 0;
+    values->count = 0;
+
+    Call_Site *site = prepare_call(compiler, sv_from_cstr(test->call), types, values);
+    if (!site) return false;
+    void *result = call_result_buffer(site);
+    if (!result && site->return_type != &ffi_type_void) return false;
+    call_site_invoke(site, values->items, result);
+
+    if (site->return_type == &ffi_type_sint && *(int *)result != test->expected) {
+        fprintf(stderr, "FAIL: '%s' returned %d, expected %ld\n",
+                test->call, *(int *)result, test->expected);
+        return false;
+    }
+    return true;
+}
+
+int main(void) {
+    Compiler_Context *compiler = compile_source(test_source, "test_arena.c", false);
+    if (!compiler) {
+        fprintf(stderr, "FAIL: could not compile the test source\n");
+        return 1;
+    }
+    compiler->source_code = strdup(test_source);  // Owned by the context, as in main()
+
+    Type_Array types = {0};
+    Value_Array values = {0};
+    unsigned long warm_mallocs = 0;
+    size_t warm_chunks = 0;
+    int status = 0;
+
+    for (int round = 0; round < TEST_WARMUP_ROUNDS + TEST_ROUNDS; round++) {
+        if (round == TEST_WARMUP_ROUNDS) {
+            warm_mallocs = test_mallocs;
+            warm_chunks = temp_arena.chunk_allocs;
+        }
+        for (size_t i = 0; i < TEST_CALL_COUNT; i++) {
+            if (!test_run_call(compiler, &test_calls[i], &types, &values)) {
+                fprintf(stderr, "FAIL: round %d, call '%s'\n", round, test_calls[i].call);
+                status = 1;
+                goto done;
+            }
+        }
+    }
+
+    unsigned long mallocs = test_mallocs - warm_mallocs;
+    size_t chunks = temp_arena.chunk_allocs - warm_chunks;
+    printf("%d rounds of %zu calls after warmup: %lu malloc(s), %zu arena chunk(s)\n",
+           TEST_ROUNDS, TEST_CALL_COUNT, mallocs, chunks);
+    if (mallocs || chunks) {
+        fprintf(stderr, "FAIL: the call path allocates in steady state\n");
+        status = 1;
+    } else {
+        printf("PASS\n");
+    }
+
+done:
+    da_free(&types);
+    da_free(&values);
+    arena_free(&temp_arena);
+    compiler_destroy(compiler);
+    return status;
+}